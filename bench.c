@@ -0,0 +1,463 @@
+// Benchmark harness for the calculator variants.
+//
+// Build:  gcc -O2 -o bench bench.c
+// Usage:  ./bench [-n requests] [-s seed] [-T timeout_ms] [-p] [-a presets] "./cal" "./cal_best -t shm" ...
+//
+// Each variant is started on a pseudo-terminal so its stdout stays line
+// buffered, then driven twice with the same scripted workload:
+//   latency    - one request at a time, timing each round trip
+//   throughput - every request written ahead while results are read back
+// -p streams the throughput phase through plain pipes instead, which lets
+// cal_best switch to its batch mode. -a pair,spread,... runs cal_best once per
+// --affinity preset, to compare how CPU placement shifts the round trip; the
+// other variants have no such option and run once. The report is a JSON array
+// on stdout.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define MAX_ARGS 32
+#define MAX_PRESETS 8
+#define READ_CHUNK 65536
+#define HIST_BUCKETS 40    // Power-of-two latency buckets, 1 ns .. ~9 minutes
+#define LOST_LIMIT 3       // Consecutive timeouts before a variant is given up on
+
+struct request {
+    int a, b;
+    char op;
+    long long expected;
+};
+
+// Outcome of one phase against one variant
+struct phase_result {
+    int ok;
+    int wrong;
+    int lost;
+    double seconds;
+    long long *latencies;   // Per-request round trip in ns, latency phase only
+    int num_latencies;
+};
+
+// Reader state for one variant's output stream
+struct output_reader {
+    int fd;
+    char buf[READ_CHUNK];
+    size_t used;
+};
+
+struct request *requests;
+int num_requests = 10000;
+int timeout_ms = 1000;
+int use_pipes;
+char *presets[MAX_PRESETS];  // cal_best --affinity presets to sweep, none given means run as is
+int num_presets;
+
+void make_workload(unsigned seed);
+pid_t spawn_variant(char *argv[], int use_pty, int *in_fd, int *out_fd);
+void stop_variant(pid_t pid, int in_fd, int out_fd);
+void run_latency(char *argv[], struct phase_result *result);
+void run_throughput(char *argv[], struct phase_result *result);
+int next_answer(struct output_reader *reader, int wait_ms, long long *value);
+void score(struct phase_result *result, int index, int status, long long value);
+void report(const char *name, const char *preset, struct phase_result *latency, struct phase_result *throughput, int first);
+int takes_affinity(const char *command);
+long long now_ns(void);
+int compare_ll(const void *x, const void *y);
+
+enum { ANSWER_RESULT, ANSWER_INVALID, ANSWER_TIMEOUT, ANSWER_EOF };
+
+int main(int argc, char *argv[]) {
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:T:pa:")) != -1) {
+        if (opt == 'n' && atoi(optarg) > 0) {
+            num_requests = atoi(optarg);
+        } else if (opt == 's') {
+            seed = strtoul(optarg, NULL, 10);
+        } else if (opt == 'T' && atoi(optarg) > 0) {
+            timeout_ms = atoi(optarg);
+        } else if (opt == 'p') {
+            use_pipes = 1;
+        } else if (opt == 'a') {
+            for (char *tok = strtok(optarg, ","); tok && num_presets < MAX_PRESETS; tok = strtok(NULL, ",")) {
+                presets[num_presets++] = tok;
+            }
+        } else {
+            fprintf(stderr, "Usage: %s [-n requests] [-s seed] [-T timeout_ms] [-p] [-a presets] \"command args\"...\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind == argc) {
+        fprintf(stderr, "No variants given\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // A variant that dies mid-run must not take the harness with it
+    signal(SIGPIPE, SIG_IGN);
+    make_workload(seed);
+
+    printf("[\n");
+    for (int v = optind; v < argc; v++) {
+        int sweep = num_presets && takes_affinity(argv[v]);
+        for (int a = 0; a < (sweep ? num_presets : 1); a++) {
+            const char *preset = sweep ? presets[a] : NULL;
+
+            // Split the command string on spaces
+            char command[1024];
+            char *args[MAX_ARGS];
+            int n = 0;
+            snprintf(command, sizeof(command), "%s", argv[v]);
+            for (char *tok = strtok(command, " "); tok && n < MAX_ARGS - 3; tok = strtok(NULL, " ")) {
+                args[n++] = tok;
+            }
+            if (preset) {
+                args[n++] = "--affinity";
+                args[n++] = (char *)preset;
+            }
+            args[n] = NULL;
+
+            struct phase_result latency = {0}, throughput = {0};
+            fprintf(stderr, "Benchmarking %s%s%s\n", argv[v], preset ? " --affinity " : "", preset ? preset : "");
+            run_latency(args, &latency);
+            run_throughput(args, &throughput);
+            report(argv[v], preset, &latency, &throughput, v == optind && a == 0);
+            free(latency.latencies);
+        }
+    }
+    printf("\n]\n");
+
+    free(requests);
+    return 0;
+}
+
+void make_workload(unsigned seed) {
+    const char ops[] = "+-*";
+
+    // Small operands keep every product inside an int for all variants
+    requests = malloc(num_requests * sizeof(struct request));
+    srand(seed);
+    for (int i = 0; i < num_requests; i++) {
+        struct request *r = &requests[i];
+        r->a = rand() % 20001 - 10000;
+        r->b = rand() % 20001 - 10000;
+        r->op = ops[rand() % 3];
+        r->expected = r->op == '+' ? r->a + r->b : r->op == '-' ? r->a - r->b : (long long)r->a * r->b;
+    }
+}
+
+pid_t spawn_variant(char *argv[], int use_pty, int *in_fd, int *out_fd) {
+    int to_child[2], from_child[2];
+    int master = -1;
+    char *slave_name = NULL;
+
+    if (use_pty) {
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1 ||
+            !(slave_name = ptsname(master))) {
+            perror("Error opening pseudo-terminal");
+            exit(EXIT_FAILURE);
+        }
+    } else if (pipe(to_child) == -1 || pipe(from_child) == -1) {
+        perror("Error creating pipes");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("Error forking variant");
+        exit(EXIT_FAILURE);
+    } else if (pid == 0) {
+        // New session so the variant and all its children can be killed together
+        setsid();
+        if (use_pty) {
+            int slave = open(slave_name, O_RDWR);
+            struct termios tio;
+            if (slave == -1 || tcgetattr(slave, &tio) == -1) {
+                perror("Error opening terminal slave");
+                _exit(127);
+            }
+            cfmakeraw(&tio);  // No echo and no \n -> \r\n translation
+            tcsetattr(slave, TCSANOW, &tio);
+            dup2(slave, STDIN_FILENO);
+            dup2(slave, STDOUT_FILENO);
+            dup2(slave, STDERR_FILENO);
+            close(slave);
+            close(master);
+        } else {
+            dup2(to_child[0], STDIN_FILENO);
+            dup2(from_child[1], STDOUT_FILENO);
+            close(to_child[0]);
+            close(to_child[1]);
+            close(from_child[0]);
+            close(from_child[1]);
+        }
+        execvp(argv[0], argv);
+        perror("Error starting variant");
+        _exit(127);
+    }
+
+    if (use_pty) {
+        *in_fd = master;
+        *out_fd = master;
+    } else {
+        close(to_child[0]);
+        close(from_child[1]);
+        *in_fd = to_child[1];
+        *out_fd = from_child[0];
+    }
+    return pid;
+}
+
+void stop_variant(pid_t pid, int in_fd, int out_fd) {
+    // Ask politely, then take down the whole session
+    if (in_fd != -1 && write(in_fd, "q\n", 2) == -1 && errno != EPIPE && errno != EAGAIN) {
+        perror("Error stopping variant");
+    }
+    for (int i = 0; i < 50 && waitpid(pid, NULL, WNOHANG) == 0; i++) {
+        usleep(10000);
+    }
+    kill(-pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    if (in_fd != -1) {
+        close(in_fd);
+    }
+    if (out_fd != in_fd) {
+        close(out_fd);
+    }
+}
+
+void run_latency(char *argv[], struct phase_result *result) {
+    struct output_reader reader = {0};
+    int in_fd;
+    pid_t pid = spawn_variant(argv, 1, &in_fd, &reader.fd);
+    int consecutive_lost = 0;
+    long long start = now_ns();
+
+    result->latencies = malloc(num_requests * sizeof(long long));
+    for (int i = 0; i < num_requests; i++) {
+        char line[64];
+        long long value;
+        int len = snprintf(line, sizeof(line), "%d %d %c\n", requests[i].a, requests[i].b, requests[i].op);
+
+        if (consecutive_lost >= LOST_LIMIT) {
+            result->lost += num_requests - i;  // The variant has stopped answering
+            break;
+        }
+
+        long long sent = now_ns();
+        int status = ANSWER_EOF;
+        if (write(in_fd, line, len) == len) {
+            status = next_answer(&reader, timeout_ms, &value);
+        }
+        if (status == ANSWER_TIMEOUT || status == ANSWER_EOF) {
+            consecutive_lost++;
+        } else {
+            consecutive_lost = 0;
+            result->latencies[result->num_latencies++] = now_ns() - sent;
+        }
+        score(result, i, status, value);
+    }
+    result->seconds = (now_ns() - start) / 1e9;
+
+    stop_variant(pid, in_fd, reader.fd);
+}
+
+void run_throughput(char *argv[], struct phase_result *result) {
+    static char script[1 << 16];
+    struct output_reader reader = {0};
+    int in_fd;
+    pid_t pid = spawn_variant(argv, !use_pipes, &in_fd, &reader.fd);
+    size_t script_len = 0, script_off = 0;
+    int next_to_send = 0, answered = 0;
+    int closed = 0;
+    long long start = now_ns();
+    long long last_progress = start;
+
+    fcntl(in_fd, F_SETFL, fcntl(in_fd, F_GETFL) | O_NONBLOCK);
+    while (answered < num_requests) {
+        // Refill the outgoing script, ending with 'q'
+        if (script_off == script_len && next_to_send <= num_requests && !closed) {
+            script_len = script_off = 0;
+            while (next_to_send < num_requests && script_len + 64 < sizeof(script)) {
+                struct request *r = &requests[next_to_send++];
+                script_len += snprintf(script + script_len, 64, "%d %d %c\n", r->a, r->b, r->op);
+            }
+            if (next_to_send == num_requests) {
+                script_len += snprintf(script + script_len, 64, "q\n");
+                next_to_send++;
+            }
+        }
+
+        // Write ahead as far as the variant accepts, read whatever is back
+        if (script_off < script_len) {
+            ssize_t n = write(in_fd, script + script_off, script_len - script_off);
+            if (n > 0) {
+                script_off += n;
+                last_progress = now_ns();
+            } else if (n == -1 && errno != EAGAIN) {
+                closed = 1;
+                script_off = script_len;
+            }
+        }
+        if (use_pipes && next_to_send > num_requests && script_off == script_len && !closed) {
+            close(in_fd);  // End of input lets a batch-mode variant finish
+            in_fd = -1;
+            closed = 1;
+        }
+
+        // Poll briefly while there is still input to push, give up once
+        // the variant has neither read nor answered for the timeout
+        long long value;
+        int more = script_off < script_len || (next_to_send <= num_requests && !closed);
+        int status = next_answer(&reader, more ? 1 : timeout_ms, &value);
+        if (status == ANSWER_TIMEOUT && now_ns() - last_progress < timeout_ms * 1000000LL) {
+            continue;
+        }
+        if (status == ANSWER_TIMEOUT || status == ANSWER_EOF) {
+            break;
+        }
+        score(result, answered++, status, value);
+        last_progress = now_ns();
+    }
+    result->lost += num_requests - answered;
+    result->seconds = (now_ns() - start) / 1e9;
+
+    stop_variant(pid, in_fd, reader.fd);
+}
+
+int next_answer(struct output_reader *reader, int wait_ms, long long *value) {
+    while (1) {
+        // Look for a complete line that answers a request
+        char *start = reader->buf;
+        char *newline;
+        while ((newline = memchr(start, '\n', reader->buf + reader->used - start))) {
+            *newline = '\0';
+            char *found = strstr(start, "Result: ");
+            int status = -1;
+            if (found) {
+                *value = strtoll(found + 8, NULL, 10);
+                status = ANSWER_RESULT;
+            } else if (strstr(start, "Invalid") || strncmp(start, "E ", 2) == 0) {
+                status = ANSWER_INVALID;
+            } else {
+                // Compact output (-c): a bare number, possibly after the prompt
+                char *text = strrchr(start, ':') ? strrchr(start, ':') + 1 : start;
+                char *end;
+                *value = strtoll(text, &end, 10);
+                if (end != text && *end == '\0') {
+                    status = ANSWER_RESULT;
+                }
+            }
+            start = newline + 1;
+            if (status != -1) {
+                reader->used -= start - reader->buf;
+                memmove(reader->buf, start, reader->used);
+                return status;
+            }
+        }
+        reader->used -= start - reader->buf;
+        memmove(reader->buf, start, reader->used);
+        if (reader->used == sizeof(reader->buf)) {
+            reader->used = 0;  // Runaway line without a newline, drop it
+        }
+
+        struct pollfd pfd = {.fd = reader->fd, .events = POLLIN};
+        int ready = poll(&pfd, 1, wait_ms);
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            return ANSWER_TIMEOUT;
+        }
+        ssize_t n = read(reader->fd, reader->buf + reader->used, sizeof(reader->buf) - reader->used);
+        if (n <= 0) {
+            return ANSWER_EOF;  // EIO on a pty once the variant has exited
+        }
+        reader->used += n;
+    }
+}
+
+void score(struct phase_result *result, int index, int status, long long value) {
+    if (status == ANSWER_RESULT && value == requests[index].expected) {
+        result->ok++;
+    } else if (status == ANSWER_RESULT || status == ANSWER_INVALID) {
+        result->wrong++;
+    } else {
+        result->lost++;
+    }
+}
+
+void report(const char *name, const char *preset, struct phase_result *latency, struct phase_result *throughput, int first) {
+    long long *lat = latency->latencies;
+    int n = latency->num_latencies;
+    int hist[HIST_BUCKETS] = {0};
+
+    qsort(lat, n, sizeof(long long), compare_ll);
+    for (int i = 0; i < n; i++) {
+        int bucket = 0;
+        while (bucket < HIST_BUCKETS - 1 && (1LL << (bucket + 1)) <= lat[i]) {
+            bucket++;
+        }
+        hist[bucket]++;
+    }
+
+    printf("%s  {\n    \"variant\": \"", first ? "" : ",\n");
+    for (const char *p = name; *p; p++) {
+        printf(*p == '"' || *p == '\\' ? "\\%c" : "%c", *p);
+    }
+    printf("\",\n");
+    if (preset) {
+        printf("    \"affinity\": \"%s\",\n", preset);  // Preset names need no escaping
+    }
+    printf("    \"requests\": %d,\n", num_requests);
+    printf("    \"latency\": {\"ok\": %d, \"wrong\": %d, \"lost\": %d, ", latency->ok, latency->wrong, latency->lost);
+    printf("\"p50_ns\": %lld, \"p99_ns\": %lld, \"p999_ns\": %lld, \"max_ns\": %lld,\n",
+           n ? lat[n / 2] : 0, n ? lat[(int)(n * 0.99)] : 0, n ? lat[(int)(n * 0.999)] : 0, n ? lat[n - 1] : 0);
+    printf("                \"histogram_ns\": {");
+    int printed = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        if (hist[b]) {
+            printf("%s\"%lld\": %d", printed++ ? ", " : "", 1LL << b, hist[b]);
+        }
+    }
+    printf("}},\n");
+    printf("    \"throughput\": {\"ok\": %d, \"wrong\": %d, \"lost\": %d, \"seconds\": %.6f, \"requests_per_sec\": %.1f}\n",
+           throughput->ok, throughput->wrong, throughput->lost, throughput->seconds,
+           throughput->seconds > 0 ? throughput->ok / throughput->seconds : 0.0);
+    printf("  }");
+    fflush(stdout);
+}
+
+int takes_affinity(const char *command) {
+    // The program is the command's first word, with or without a directory
+    size_t len = strcspn(command, " ");
+    const char *name = command;
+    for (const char *p = command; p < command + len; p++) {
+        if (*p == '/') {
+            name = p + 1;
+        }
+    }
+    return (size_t)(command + len - name) == strlen("cal_best") && strncmp(name, "cal_best", strlen("cal_best")) == 0;
+}
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int compare_ll(const void *x, const void *y) {
+    long long a = *(const long long *)x, b = *(const long long *)y;
+    return (a > b) - (a < b);
+}
@@ -1,37 +1,817 @@
+#define _GNU_SOURCE  // F_GETPIPE_SZ, CPU_SET
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
-#define NUM_CHILDREN 3
-#define BUFFER_SIZE 20
+#define MAX_WORKERS 64
+#define BUFFER_SIZE 256        // Interactive line buffer, longer lines are rejected whole
+#define BATCH_MAX 4096          // Max operand pairs per frame (32 KiB, fits an empty pipe)
+#define INPUT_CHUNK (1 << 16)   // Bytes read from stdin per read() in batch mode
+#define CACHE_LINE 64
+#define RING_WORDS (1 << 15)    // Ints per shared-memory ring, a power of two
+#define SPIN_LIMIT 1024         // Busy-wait iterations before yielding the CPU
+#define PIPELINE_DEPTH 2        // Frames in flight per child with --io uring, sized into its buffers
+#define RESULT_CREDIT (2 * (3 + BATCH_MAX) * (int)sizeof(int))  // Most result bytes a child may owe, half a default pipe
+#define OUTBOX_BYTES (2 * RESULT_CREDIT)  // Room for the requests of every frame the credit allows
+#define FRAME_SLOTS 256         // In-flight frame table size, a power of two
+#define WINDOW_LINES (1 << 16)  // Input lines between parsing and output, a power of two
+#define SLICE_RECORDS (1 << 16) // Bulk job records scanned per frame
+#define SLICE_RUN 256           // Bulk records an operation gathers for one kernel call
+#define EXPR_NODES (1 << 17)    // Expression node ring, a power of two with room for any input line
+#define EXPR_DEPTH 256          // Deepest parenthesis nesting accepted
+#define URING_ENTRIES 256       // Submission queue size for the io_uring loop
+#define CACHE_PROBE 8           // Result cache slots searched per lookup, also the eviction window
+#define OUTPUT_BLOCK (1 << 16)  // Bytes per output block
+#define OUTPUT_BLOCKS 8         // Output blocks gathered into one writev()
+#define OUTPUT_RECORD 128       // Room reserved for one formatted result
+#define MAX_CLIENTS 1024        // Concurrent connections in server mode
+#define CLIENT_BUFFER (1 << 12) // Request bytes read from a client at a time
+#define CLIENT_BACKLOG (1 << 16) // Unread reply bytes after which a client's requests are no longer read
+#define MAX_CPUS CPU_SETSIZE    // CPUs an affinity mask can name
+#define SLICE_FRAME -1          // Frame count marking a record range of the bulk job instead of pairs
 
-int pipes_to_child[NUM_CHILDREN][2];   // Pipes for sending data to children
-int pipes_to_parent[NUM_CHILDREN][2];  // Pipes for receiving results from children
+int pipes_to_child[MAX_WORKERS][2];   // Pipes for sending data to children
+int pipes_to_parent[MAX_WORKERS][2];  // Pipes for receiving results from children
 int child_index;  // Global variable to identify child process index
+int num_workers;  // Children forked across all pools
+
+// Operation indexes, in the order of the operations[] registry below; one worker pool each
+enum { OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW, OP_MIN, OP_MAX, OP_AND, OP_XOR, OP_OR, NUM_OPS };
+
+int pool_size[NUM_OPS];              // Workers per operation
+int first_worker[NUM_OPS];           // Index of each pool's first worker
+int worker_op[MAX_WORKERS];          // Operation each worker computes
+int next_in_pool[NUM_OPS];           // Round-robin position for single requests
+int batch_mode;   // Non-zero when stdin is streamed instead of prompted
+
+enum { TRANSPORT_PIPE, TRANSPORT_SHM, TRANSPORT_RTSIG, TRANSPORT_THREAD };
+int transport = TRANSPORT_PIPE;  // How requests and results travel, TRANSPORT_THREAD runs workers as threads
+int probe_count;                 // Round trips to time instead of reading input
+
+enum { WAKE_SIGNAL, WAKE_EVENTFD, WAKE_FUTEX };
+int wakeup = WAKE_SIGNAL;        // How the parent wakes a sleeping child
+int event_fds[MAX_WORKERS];      // Per-child eventfd for WAKE_EVENTFD
+int signal_fd;                   // Child's signalfd for WAKE_SIGNAL
+
+// Where the parent and the workers run: left to the kernel, a worker on the
+// parent's sibling hyperthread, one worker per core, the parent's core kept
+// for the parent alone, or CPUs named per pool
+enum { AFFINITY_NONE, AFFINITY_PAIR, AFFINITY_SPREAD, AFFINITY_ISOLATE, AFFINITY_LIST };
+int affinity = AFFINITY_NONE;
+int affinity_first[NUM_OPS + 1];        // AFFINITY_LIST: first CPU of each pool, then the parent's; -1 if unpinned
+cpu_set_t parent_cpus;                  // Empty for no pinning
+cpu_set_t worker_cpus[MAX_WORKERS];
+
+// Batch arithmetic kernel for one operation, chosen once at startup from what the CPU supports
+typedef void (*batch_kernel)(const int *x, const int *y, int *results, int count);
+batch_kernel op_kernels[NUM_OPS];
+
+// Everything that differs between operations. Parsing, pools, kernels and the
+// binary formats all work from this table, so an operation is added in one place.
+struct operation {
+    const char *name;     // Pool name for --workers and the stats
+    const char *symbol;   // Written after the operands, or between them in an expression
+    char code;            // Byte that stands for it in bulk records and the wire protocol
+    int precedence;       // Higher binds tighter in expressions
+    int right_assoc;      // a ^ b ^ c is a ^ (b ^ c)
+    batch_kernel scalar;
+    batch_kernel sse2;    // NULL where there is no vector kernel
+    batch_kernel avx2;
+};
+
+unsigned char symbol_ops[256];  // One-byte symbol to operation + 1, 0 for none
+unsigned char code_ops[256];    // Same for the binary code
+char op_list[64];               // "+, -, ..., or |" for prompts and errors
+char bad_op_text[OUTPUT_RECORD];
+
+// Single-producer single-consumer ring of ints in shared memory.
+// head and tail live on separate cache lines so the two sides do not false-share.
+struct shm_ring {
+    _Alignas(CACHE_LINE) atomic_uint head;  // Next word the consumer reads
+    _Alignas(CACHE_LINE) atomic_uint tail;  // Next word the producer writes
+    _Alignas(CACHE_LINE) int words[RING_WORDS];
+};
+
+// Shared-memory channel to one child, mapped before fork()
+struct shm_channel {
+    struct shm_ring requests;  // Operand pairs, parent -> child
+    struct shm_ring results;   // Results, child -> parent
+    _Alignas(CACHE_LINE) atomic_int waiting;  // Child is about to sleep and needs a wakeup, also the futex word
+    atomic_uint posted;                       // Frames sent so far, polled by a spinning child
+};
+
+struct shm_channel *channels;  // One per child for TRANSPORT_SHM, WAKE_FUTEX or --spin over pipes
+
+// Bounded lock-free multi-producer multi-consumer queue of frame sequence IDs.
+// Each cell's sequence number says whether it is ready to be written or read.
+struct mpmc_queue {
+    _Alignas(CACHE_LINE) atomic_uint enqueue_pos;
+    _Alignas(CACHE_LINE) atomic_uint dequeue_pos;
+    _Alignas(CACHE_LINE) atomic_uint sleepers;  // Consumers blocked or about to block
+    atomic_uint wake_seq;                        // Futex word, bumped to wake them
+    struct {
+        atomic_uint sequence;
+        int value;
+    } cells[FRAME_SLOTS];
+};
+
+// Time spent in one stage of the request path
+struct stage_stat {
+    atomic_ullong count;
+    atomic_ullong ns;
+};
+
+enum { STAGE_SEND, STAGE_WAKE, STAGE_RECEIVE,                    // Parent
+       STAGE_DELIVERY, STAGE_READ, STAGE_COMPUTE, STAGE_REPLY,   // Child
+       NUM_STAGES };
+
+// Counters of one process in the shared stats segment. Only the owner
+// writes them, so plain relaxed loads and stores are enough, and anyone
+// can read them while traffic keeps flowing.
+struct process_stats {
+    _Alignas(CACHE_LINE) struct stage_stat stages[NUM_STAGES];
+    atomic_ullong requests;    // Operand pairs computed by a child
+    atomic_llong wake_stamp;   // When the parent last woke this child, 0 once seen
+    atomic_ullong spin_hits;   // Waits that found work while spinning
+    atomic_ullong spin_misses; // Waits that ran out of spin budget and blocked
+};
+
+struct process_stats *stats;   // One per child, then the parent's, mapped before fork()
+_Thread_local int stats_slot;  // This process's or thread's entry in stats
+volatile sig_atomic_t stats_requested;  // SIGQUIT arrived, dump the stats
+
+// One record of a binary bulk job, packed exactly as it sits in the input file
+struct bulk_record {
+    int32_t nums[2];
+    uint8_t op;       // The operation's code, its symbol for all but the word operations
+} __attribute__((packed));
+
+const char *bulk_input_path;       // Input file of records, selects the bulk job
+const char *bulk_output_path;      // Output file of one int32 result per record
+struct bulk_record *bulk_records;  // Input mapping, shared with the children
+int32_t *bulk_results;             // Output mapping, written by the children in place
+int bulk_count;                    // Records in the job
+long long bulk_computed;           // Records the workers reported back
+
+// A request frame: a sequence ID and a count, then the first and second operands
+// of the pairs as two columns, each on its own cache lines so the kernels stream
+// through them with plain loads. On the wire the columns follow the header
+// back to back, count values each. A SLICE_FRAME count carries one pair
+// instead, the [start, end) records of the bulk job.
+struct request_frame {
+    int seq;
+    int count;
+    _Alignas(CACHE_LINE) int a[BATCH_MAX];
+    _Alignas(CACHE_LINE) int b[BATCH_MAX];
+};
+
+// The reply to a request frame, tagged with the same sequence ID. On the wire
+// the three header words are followed directly by count results.
+struct result_frame {
+    int seq;
+    int worker;   // Worker that computed it, which differs from the target when stolen
+    int count;
+    _Alignas(CACHE_LINE) int results[BATCH_MAX];
+};
+
+// A frame sent to a child, remembered until its results come back
+struct inflight_frame {
+    int index;                    // Worker the frame was sent to, -1 when computed inline
+    int op;
+    int count;
+    long long cost;               // Parent time spent sending and receiving it
+    int busy;                     // Open or in flight, so its sequence ID cannot be reused yet
+    unsigned lines[BATCH_MAX];    // Input line of each request, or its expression node with -e
+};
+
+// One input line waiting in the reorder window in batch mode
+struct line_entry {
+    int kind;    // LINE_RESULT, LINE_BAD_INPUT or LINE_BAD_OP
+    int index;   // Operation, then the worker that computed the result, -1 if none did
+    int result;
+    int done;    // Ready to be written out
+    int nums[2];          // Operands, kept for the result cache
+    unsigned first_node;  // Expression nodes of the line with -e
+    unsigned num_nodes;
+    unsigned root;
+    int rescan_queued;    // Already waiting in rescan
+    int client;           // Connection the request came in on in server mode
+    unsigned generation;  // ... and which use of that slot, so a closed connection's replies are dropped
+    uint32_t id;          // Client's request ID, echoed in the reply
+    unsigned number;      // Input line, for errors found while evaluating
+};
+
+enum { LINE_RESULT, LINE_BAD_INPUT, LINE_BAD_OP };
+
+struct request_frame open_frames[NUM_OPS];        // Frames being filled in batch mode, per operation
+long long frame_opened[NUM_OPS];                  // When each open frame took its first request
+int batch_limit = BATCH_MAX;                      // Pairs that fill a frame (--batch)
+long long linger_ns;                              // How long a partial frame may wait for more (--deadline)
+long long spin_ns;                                // How long an idle worker polls before it blocks (--spin)
+unsigned long long full_frames, partial_frames;   // Frames sent because they filled up, or early
+unsigned long long framed_pairs;
+struct inflight_frame inflight[FRAME_SLOTS];      // Indexed by sequence ID
+int frames_in_flight[MAX_WORKERS];
+int frames_outstanding;                           // Sum of frames_in_flight
+int owed_bytes[MAX_WORKERS];                      // Result bytes of each child's frames in flight
+int result_credit[MAX_WORKERS];                   // Result bytes each child may owe, half its result pipe
+unsigned long long window_waits;                  // Frames held back until their worker caught up
+struct mpmc_queue request_queues[NUM_OPS];        // Frames for each pool's threads with TRANSPORT_THREAD
+struct mpmc_queue completions;                    // Finished frames, threads -> parent
+struct request_frame *thread_requests;            // Frame bodies indexed by sequence ID
+struct result_frame *thread_results;
+atomic_int thread_ids[MAX_WORKERS];               // Kernel thread IDs, reported in place of PIDs
+
+// The parent's io_uring, driven with raw system calls
+struct uring {
+    int fd;
+    unsigned entries;
+    atomic_uint *sq_head;
+    atomic_uint *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    atomic_uint *cq_head;
+    atomic_uint *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;   // Queued since the last io_uring_enter()
+};
+
+// What a completion belongs to, kept in the top half of user_data
+enum { URING_FRAME_WRITE = 1, URING_WAKE, URING_RESULT_READ, URING_OUTPUT };
+
+// Frames on their way to one child, written one at a time so they never interleave in the pipe
+struct uring_child {
+    int queue[PIPELINE_DEPTH];     // Sequence IDs waiting to be written, oldest first
+    int queued;
+    int writing;                   // queue[0] has a write in flight
+    size_t written;                // Bytes of queue[0] already in the pipe
+    int rx[2 * (3 + BATCH_MAX)];   // Result bytes read so far
+    size_t rx_used;
+};
+
+int use_uring;                                    // io_uring was asked for and is available
+int uring_active;                                 // The batch pipeline currently runs on it
+struct uring uring;
+struct uring_child uring_children[MAX_WORKERS];
+int (*uring_frames)[2 + 2 * BATCH_MAX];            // Frames packed as on the wire, kept until their write completes
+uint64_t wake_value = 1;                          // What each eventfd write adds
+int output_pending;                               // Bytes of an output writev still in flight
+int next_frame_seq;
+int rtsig_seq[MAX_WORKERS];                       // Frame outstanding on each child for TRANSPORT_RTSIG
+struct line_entry window[WINDOW_LINES];           // Reorder buffer indexed by input line
+unsigned next_line;                               // Next input line to be parsed
+unsigned next_output;                             // Next input line to be written out
+int epoll_fd;                                     // Watches pipes_to_parent for completions
+
+// Request bytes a child's pipe had no room for yet, written once epoll says it drained
+struct outbox {
+    char *data;
+    size_t head;   // Next byte to write
+    size_t used;   // End of the queued bytes
+};
+
+struct outbox outboxes[MAX_WORKERS];
+int use_outboxes;  // Request pipes are nonblocking, set up with the epoll set
+unsigned input_lines;                             // Lines read so far, for error reports
+
+// Binary protocol of the server mode, fixed-size records in host byte order.
+// Replies come back in request order on each connection, so a client can
+// pipeline as many requests as it likes.
+struct wire_request {
+    uint32_t id;
+    int32_t nums[2];
+    uint8_t op;       // The operation's code, as in bulk records
+    uint8_t pad[3];
+};
+
+struct wire_reply {
+    uint32_t id;
+    int32_t status;   // WIRE_OK, WIRE_BAD_OP or WIRE_DIV_ZERO
+    int32_t result;
+    int32_t pid;      // Worker that computed the result, 0 when none did
+};
+
+enum { WIRE_OK, WIRE_BAD_OP, WIRE_DIV_ZERO };
+
+// One client connection in server mode
+struct client {
+    int fd;                    // -1 while the slot is free
+    unsigned generation;       // Bumped on every close
+    int eof;                   // Client has stopped sending, close once its replies are out
+    int dirty;                 // Waiting in dirty_clients for a flush
+    unsigned pending;          // Requests still in the reorder window
+    char rx[CLIENT_BUFFER];    // Partial request carried over between reads
+    size_t rx_used;
+    char *tx;                  // Replies not yet accepted by the socket
+    size_t tx_used;
+    size_t tx_sent;
+    size_t tx_size;
+};
+
+const char *listen_path;                          // Unix socket to serve on (--listen)
+int listen_port;                                  // Loopback TCP port to serve on (--tcp)
+int listen_fds[2];
+int server_epoll;                                 // Listeners and client connections
+int linger_timer = -1;                            // Fires when a partial frame reaches its deadline
+struct client *clients;
+int dirty_clients[MAX_CLIENTS];                   // Clients with replies to send or a close to finish
+int num_dirty;
+volatile sig_atomic_t server_stopping;
+
+// A node of an expression DAG. Identical subexpressions of a line share one
+// node, so each is computed once and may feed several operations.
+struct expr_node {
+    int op;              // Operation, or -1 for a literal
+    int state;           // NODE_WAITING, NODE_QUEUED, NODE_DONE or NODE_UNDEFINED
+    unsigned args[2];    // Operand nodes
+    unsigned line;       // Input line the node belongs to
+    int value;
+    int worker;          // Worker that computed it, -1 for a literal
+};
+
+enum { NODE_WAITING, NODE_QUEUED, NODE_DONE, NODE_UNDEFINED };  // Undefined: divides by zero
+
+// Hash-consing table for the line being parsed, entries from older lines are stale by generation
+struct node_slot {
+    unsigned generation;
+    unsigned node;
+};
+
+// Recursive-descent parser over one input line
+struct expr_parser {
+    const char *line;
+    const char *p;
+    const char *end;
+    int depth;
+    const char *problem;  // First error, NULL while parsing succeeds
+    const char *at;
+    int kind;             // LINE_BAD_INPUT or LINE_BAD_OP once problem is set
+};
+
+// A remembered result. Entries are grouped into windows of CACHE_PROBE slots.
+struct cache_entry {
+    int32_t nums[2];
+    int32_t result;
+    int8_t op;           // -1 for an empty slot
+    uint8_t referenced;  // Second-chance bit for CACHE_EVICT_CLOCK
+    int16_t worker;      // Worker that computed it, named again on a hit
+};
+
+enum { CACHE_EVICT_CLOCK, CACHE_EVICT_RANDOM };
+
+struct cache_entry *cache;                        // Result cache in the parent, NULL when disabled
+unsigned cache_mask;
+int cache_evict = CACHE_EVICT_CLOCK;
+unsigned long long cache_hits, cache_misses, cache_evictions;
+
+// Whether frames go to the workers or are computed in the parent. Auto keeps
+// whichever costs the parent less CPU time: computing a frame itself, or
+// sending it and taking the results back. The wait for the child is not
+// counted, the pipeline overlaps it with other work.
+enum { OFFLOAD_ALWAYS, OFFLOAD_NEVER, OFFLOAD_AUTO };
+int offload_policy = OFFLOAD_ALWAYS;
+double inline_pair_ns[NUM_OPS];                   // Parent cost of computing one pair inline
+long long clock_read_ns;                          // Cost of reading the parent's CPU clock itself
+double offload_frame_ns;                          // Parent cost of one offloaded frame, fixed part
+double offload_pair_ns;                           // ... and per pair
+unsigned long long inlined_frames, offloaded_frames;
+
+int expression_mode;                              // Lines are infix expressions (-e)
+struct expr_node nodes[EXPR_NODES];               // Ring of nodes, freed in input line order
+unsigned next_node;
+struct node_slot node_hash[EXPR_NODES];
+unsigned node_generation;
+unsigned rescan[WINDOW_LINES];                    // Lines with newly finished nodes, to be scheduled
+unsigned rescan_head;
+unsigned rescan_tail;
+
+char output[OUTPUT_BLOCKS][OUTPUT_BLOCK];         // Formatted results waiting for writev()
+size_t output_used[OUTPUT_BLOCKS];
+int output_block;                                 // Block being filled
+char pid_lines[MAX_WORKERS][OUTPUT_RECORD];       // Each worker's PID line and "Result: ", formatted once
+size_t pid_line_len[MAX_WORKERS];
+int compact_output;                               // One bare result per line, no PID line
+
+int signals[NUM_OPS];  // Signal that wakes each operation's workers, set up by setup_operations()
+const char digit_pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+const char *stage_names[NUM_STAGES] = {"send", "wake", "receive", "delivery", "read", "compute", "reply"};
 
 void setup_child(int index);
+void start_threads(pid_t child_pids[]);
+void *thread_loop(void *arg);
+void queue_init(struct mpmc_queue *queue);
+void queue_push(struct mpmc_queue *queue, int value);
+int queue_pop(struct mpmc_queue *queue, int *value);
+int queue_ready(struct mpmc_queue *queue);
+int queue_wait_pop(struct mpmc_queue *queue);
+void queue_wait(struct mpmc_queue *queue);
+int uses_pipes(void);
+int uring_setup(void);
+struct io_uring_sqe *uring_sqe(uint32_t kind, uint32_t index);
+void uring_enter(unsigned min_complete);
+int uring_reap(void);
+void uring_start(void);
+void uring_write_frame(int index);
+void uring_read_results(int index);
+void uring_completion(struct io_uring_cqe *cqe);
 void parent_process(pid_t child_pids[]);
-void handle_signal(int signum);
+void interactive_loop(pid_t child_pids[]);
+int stdin_drained(void);
+void batch_loop(pid_t child_pids[]);
+void queue_line(pid_t child_pids[], const char *line, size_t len);
+void queue_request(pid_t child_pids[], int op, unsigned tag, int a, int b);
+void queue_pair(pid_t child_pids[], struct line_entry *entry);
+void server_loop(pid_t child_pids[]);
+int open_listener(int domain, struct sockaddr *addr, socklen_t len);
+void accept_clients(int fd);
+void read_client(pid_t child_pids[], int slot);
+void queue_wire_request(pid_t child_pids[], int slot, const struct wire_request *request);
+void server_reply(pid_t child_pids[], struct line_entry *entry);
+void flush_client(int slot);
+void watch_client(int slot);
+void close_client(int slot);
+void handle_stop_signal(int signum);
+void calibrate_offload(pid_t child_pids[]);
+long long time_offload(pid_t child_pids[], int index, struct request_frame *frame, struct result_frame *done);
+void await_results(int index, int count);
+int should_inline(int op, int count);
+void inline_frame(int op);
+void setup_cache(int capacity);
+int cache_lookup(int op, int a, int b, int *result, int *worker);
+void cache_insert(int op, int a, int b, int result, int worker);
+int queue_expression(pid_t child_pids[], struct line_entry *entry, const char *line, size_t len);
+void make_room(pid_t child_pids[], size_t nodes_needed);
+void schedule_nodes(pid_t child_pids[]);
+void request_rescan(unsigned line);
+unsigned parse_binary(struct expr_parser *ps, int min_precedence);
+unsigned parse_factor(struct expr_parser *ps);
+unsigned make_node(int op, unsigned a, unsigned b, int value);
+void parse_error(struct expr_parser *ps, int kind, const char *problem);
+void bulk_job(pid_t child_pids[]);
+void map_bulk_files(void);
+void watch_results(void);
+void dispatch_frame(pid_t child_pids[], int index);
+void dispatch_all(pid_t child_pids[]);
+void dispatch_ready(pid_t child_pids[]);
+void arm_linger_timer(void);
+void collect_results(int block);
+void complete_frame(struct result_frame *done);
+void write_output(pid_t child_pids[]);
+void prepare_output(pid_t child_pids[]);
+char *output_space(void);
+void flush_output(void);
+size_t format_int(char *out, int value);
+void finish_pending(pid_t child_pids[]);
+void drain_requests(int index);
+int requests_pending(int index);
+int next_request(int index, struct request_frame *frame);
+int ring_take_frame(struct shm_ring *ring, struct request_frame *frame);
+void process_frame(int index, struct request_frame *frame);
+int compute_slice(int start, int end);
+void compute_run(int op, const int *a, const int *b, const int *at, int count);
+void wait_for_work(int index);
+void rtsig_loop(int index);
+void wake_child(pid_t child_pids[], int index);
+void compute_batch(int op, const int *a, const int *b, int *results, int count);
+void select_kernel(const char *name);
+void setup_operations(void);
+size_t match_operation(const char *p, const char *end, int *op);
+int divide(int a, int b);
+int modulo(int a, int b);
+int power(int a, int b);
+void scalar_add(const int *x, const int *y, int *results, int count);
+void scalar_sub(const int *x, const int *y, int *results, int count);
+void scalar_mul(const int *x, const int *y, int *results, int count);
+void scalar_div(const int *x, const int *y, int *results, int count);
+void scalar_mod(const int *x, const int *y, int *results, int count);
+void scalar_pow(const int *x, const int *y, int *results, int count);
+void scalar_min(const int *x, const int *y, int *results, int count);
+void scalar_max(const int *x, const int *y, int *results, int count);
+void scalar_and(const int *x, const int *y, int *results, int count);
+void scalar_xor(const int *x, const int *y, int *results, int count);
+void scalar_or(const int *x, const int *y, int *results, int count);
+#if defined(__x86_64__) || defined(__i386__)
+void sse2_add(const int *x, const int *y, int *results, int count);
+void sse2_sub(const int *x, const int *y, int *results, int count);
+void sse2_mul(const int *x, const int *y, int *results, int count);
+void sse2_min(const int *x, const int *y, int *results, int count);
+void sse2_max(const int *x, const int *y, int *results, int count);
+void sse2_and(const int *x, const int *y, int *results, int count);
+void sse2_xor(const int *x, const int *y, int *results, int count);
+void sse2_or(const int *x, const int *y, int *results, int count);
+void avx2_add(const int *x, const int *y, int *results, int count);
+void avx2_sub(const int *x, const int *y, int *results, int count);
+void avx2_mul(const int *x, const int *y, int *results, int count);
+void avx2_min(const int *x, const int *y, int *results, int count);
+void avx2_max(const int *x, const int *y, int *results, int count);
+void avx2_and(const int *x, const int *y, int *results, int count);
+void avx2_xor(const int *x, const int *y, int *results, int count);
+void avx2_or(const int *x, const int *y, int *results, int count);
+#define VECTOR_KERNELS(name) sse2_##name, avx2_##name
+#else
+#define VECTOR_KERNELS(name) NULL, NULL
+#endif
+int pick_worker(int op);
+int window_open(int index, int count);
+int claim_seq(pid_t child_pids[], int op);
+int result_bytes(int count);
+void post_request(int index, struct iovec *parts, int count, size_t len);
+size_t frame_iov(struct request_frame *frame, struct iovec parts[3]);
+void copy_frame(struct request_frame *to, const struct request_frame *from);
+int readv_full(int fd, struct iovec *parts, int count);
+int writev_full(int fd, struct iovec *parts, int count);
+int flush_outbox(int index);
+void parse_workers(char *spec);
+void parse_affinity(char *spec);
+void plan_affinity(void);
+int core_of(int cpu);
+void pin_cpus(const cpu_set_t *mask);
+void latency_probe(pid_t child_pids[]);
+int parse_request(const char *input, size_t len, int nums[2], int *index);
+const char *parse_int(const char **cursor, const char *end, int *value);
+void report_line(const char *line, const char *at, const char *problem);
+int frame_pairs(int count);
+long long now_ns(void);
+long long parent_cpu_ns(void);
+long long cpu_since(long long start);
+void stat_add(int stage, long long start);
+void handle_stats_signal(int signum);
+void dump_stats(void);
+void send_frame(pid_t child_pids[], int index, struct request_frame *frame);
+void receive_results(int index, struct result_frame *done);
+int read_full(int fd, void *buf, size_t len);
+int write_full(int fd, const void *buf, size_t len);
+void ring_push(struct shm_ring *ring, const int *words, unsigned count);
+void ring_pop(struct shm_ring *ring, int *words, unsigned count);
+void spin_wait(int *spins);
+void cpu_pause(void);
+int spin_for_change(atomic_uint *word, unsigned seen);
+
+// A zero divisor is rejected as invalid input before it reaches a kernel. INT_MIN / -1
+// wraps to INT_MIN and INT_MIN % -1 is 0, like the other operations wrap instead of
+// trapping. A negative power is 0 unless the base is 1 or -1.
+const struct operation operations[NUM_OPS] = {
+    [OP_ADD] = {"add", "+", '+', 4, 0, scalar_add, VECTOR_KERNELS(add)},
+    [OP_SUB] = {"sub", "-", '-', 4, 0, scalar_sub, VECTOR_KERNELS(sub)},
+    [OP_MUL] = {"mul", "*", '*', 5, 0, scalar_mul, VECTOR_KERNELS(mul)},
+    [OP_DIV] = {"div", "/", '/', 5, 0, scalar_div, NULL, NULL},
+    [OP_MOD] = {"mod", "%", '%', 5, 0, scalar_mod, NULL, NULL},
+    [OP_POW] = {"pow", "^", '^', 6, 1, scalar_pow, NULL, NULL},
+    [OP_MIN] = {"min", "min", 'm', 0, 0, scalar_min, VECTOR_KERNELS(min)},
+    [OP_MAX] = {"max", "max", 'M', 0, 0, scalar_max, VECTOR_KERNELS(max)},
+    [OP_AND] = {"and", "&", '&', 3, 0, scalar_and, VECTOR_KERNELS(and)},
+    [OP_XOR] = {"xor", "xor", 'x', 2, 0, scalar_xor, VECTOR_KERNELS(xor)},
+    [OP_OR] = {"or", "|", '|', 1, 0, scalar_or, VECTOR_KERNELS(or)},
+};
+
+int main(int argc, char *argv[]) {
+    pid_t child_pids[MAX_WORKERS];
+    int opt;
+    const char *kernel_name = NULL;
+    struct option long_options[] = {
+        {"workers", required_argument, NULL, 'W'},
+        {"cache", required_argument, NULL, 'm'},
+        {"evict", required_argument, NULL, 'E'},
+        {"offload", required_argument, NULL, 'O'},
+        {"io", required_argument, NULL, 'u'},
+        {"listen", required_argument, NULL, 'L'},
+        {"tcp", required_argument, NULL, 'T'},
+        {"batch", required_argument, NULL, 'B'},
+        {"deadline", required_argument, NULL, 'D'},
+        {"spin", required_argument, NULL, 'S'},
+        {"affinity", required_argument, NULL, 'A'},
+        {NULL, 0, NULL, 0},
+    };
+
+    setup_operations();
+
+    // Stream the input when it is not a terminal, unless told otherwise
+    batch_mode = !isatty(STDIN_FILENO);
+    while ((opt = getopt_long(argc, argv, "bit:w:l:W:k:f:o:cem:E:O:u:L:T:B:D:S:A:", long_options, NULL)) != -1) {
+        if (opt == 'b') {
+            batch_mode = 1;
+        } else if (opt == 'i') {
+            batch_mode = 0;
+        } else if (opt == 't' && strcmp(optarg, "pipe") == 0) {
+            transport = TRANSPORT_PIPE;
+        } else if (opt == 't' && strcmp(optarg, "shm") == 0) {
+            transport = TRANSPORT_SHM;
+        } else if (opt == 't' && strcmp(optarg, "rtsig") == 0) {
+            transport = TRANSPORT_RTSIG;
+        } else if (opt == 't' && strcmp(optarg, "thread") == 0) {
+            transport = TRANSPORT_THREAD;
+        } else if (opt == 'W') {
+            parse_workers(optarg);
+        } else if (opt == 'k') {
+            kernel_name = optarg;
+        } else if (opt == 'c') {
+            compact_output = 1;
+        } else if (opt == 'e') {
+            expression_mode = 1;
+        } else if (opt == 'm' && atoi(optarg) > 0) {
+            setup_cache(atoi(optarg));
+        } else if (opt == 'E' && strcmp(optarg, "clock") == 0) {
+            cache_evict = CACHE_EVICT_CLOCK;
+        } else if (opt == 'E' && strcmp(optarg, "random") == 0) {
+            cache_evict = CACHE_EVICT_RANDOM;
+        } else if (opt == 'O' && strcmp(optarg, "always") == 0) {
+            offload_policy = OFFLOAD_ALWAYS;
+        } else if (opt == 'O' && strcmp(optarg, "never") == 0) {
+            offload_policy = OFFLOAD_NEVER;
+        } else if (opt == 'O' && strcmp(optarg, "auto") == 0) {
+            offload_policy = OFFLOAD_AUTO;
+        } else if (opt == 'u' && strcmp(optarg, "syscalls") == 0) {
+            use_uring = 0;
+        } else if (opt == 'u' && strcmp(optarg, "uring") == 0) {
+            use_uring = 1;
+        } else if (opt == 'L') {
+            listen_path = optarg;
+        } else if (opt == 'T' && atoi(optarg) > 0 && atoi(optarg) < 65536) {
+            listen_port = atoi(optarg);
+        } else if (opt == 'B' && atoi(optarg) > 0 && atoi(optarg) <= BATCH_MAX) {
+            batch_limit = atoi(optarg);
+        } else if (opt == 'D' && atoi(optarg) >= 0) {
+            linger_ns = atoi(optarg) * 1000LL;
+        } else if (opt == 'A') {
+            parse_affinity(optarg);
+        } else if (opt == 'S' && atoi(optarg) >= 0) {
+            spin_ns = atoi(optarg) * 1000LL;
+        } else if (opt == 'f') {
+            bulk_input_path = optarg;
+        } else if (opt == 'o') {
+            bulk_output_path = optarg;
+        } else if (opt == 'l' && atoi(optarg) > 0) {
+            probe_count = atoi(optarg);
+        } else if (opt == 'w' && strcmp(optarg, "signal") == 0) {
+            wakeup = WAKE_SIGNAL;
+        } else if (opt == 'w' && strcmp(optarg, "eventfd") == 0) {
+            wakeup = WAKE_EVENTFD;
+        } else if (opt == 'w' && strcmp(optarg, "futex") == 0) {
+            wakeup = WAKE_FUTEX;
+        } else {
+            fprintf(stderr, "Usage: %s [-b | -i] [-c] [-e] [-t pipe|shm|rtsig|thread] [-w signal|eventfd|futex] [-l round_trips]\n"
+                            "          [--workers op=N,...] [-k scalar|sse2|avx2] [-f records -o results]\n"
+                            "          [--cache entries] [--evict clock|random] [--offload always|never|auto]\n"
+                            "          [--io syscalls|uring] [--listen socket_path] [--tcp port]\n"
+                            "          [--batch pairs] [--deadline us] [--spin us]\n"
+                            "          [--affinity none|pair|spread|isolate|parent=cpu,op=cpu,...]\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!bulk_input_path != !bulk_output_path) {
+        fprintf(stderr, "A bulk job needs both an input file (-f) and an output file (-o)\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((listen_path || listen_port) && (expression_mode || bulk_input_path || probe_count)) {
+        fprintf(stderr, "A server (--listen, --tcp) takes neither -e, -f nor -l\n");
+        exit(EXIT_FAILURE);
+    }
+    if (transport == TRANSPORT_RTSIG && sizeof(void *) < sizeof(uint64_t)) {
+        // Both operands travel in sival_ptr, which only holds one of them here
+        fprintf(stderr, "-t rtsig needs 64-bit pointers to carry both operands\n");
+        exit(EXIT_FAILURE);
+    }
+    if (use_uring && transport != TRANSPORT_PIPE) {
+        fprintf(stderr, "--io uring drives pipes and needs -t pipe\n");
+        exit(EXIT_FAILURE);
+    }
+    if (use_uring && !uring_setup()) {
+        perror("io_uring unavailable, using plain system calls");
+        use_uring = 0;
+    }
+    if (use_uring) {
+        wakeup = WAKE_EVENTFD;  // A kill() cannot be queued on the ring, an eventfd write can
+    }
+    if (spin_ns > 0 && sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        // With one CPU a spinner only keeps the process it waits for off it
+        fprintf(stderr, "--spin needs a second CPU, blocking instead\n");
+        spin_ns = 0;
+    }
+    if (bulk_input_path && transport == TRANSPORT_RTSIG) {
+        fprintf(stderr, "A bulk job needs the pipe or shm transport\n");
+        exit(EXIT_FAILURE);
+    }
+
+    select_kernel(kernel_name);
+
+    // Lay the pools out one after another
+    for (int op = 0; op < NUM_OPS; op++) {
+        first_worker[op] = num_workers;
+        for (int i = 0; i < pool_size[op]; i++) {
+            worker_op[num_workers++] = op;
+        }
+    }
+    plan_affinity();
+
+    // Stats for every child plus the parent, shared so anyone can dump them
+    stats_slot = num_workers;
+    stats = mmap(NULL, (num_workers + 1) * sizeof(struct process_stats), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) {
+        perror("Error mapping stats segment");
+        exit(EXIT_FAILURE);
+    }
 
-int main() {
-    pid_t child_pids[NUM_CHILDREN];
+    // SIGQUIT dumps the stats; children inherit the handler and simply ignore the flag
+    struct sigaction sa;
+    sa.sa_handler = handle_stats_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGQUIT, &sa, NULL) == -1) {
+        perror("Error setting up signal handler");
+        exit(EXIT_FAILURE);
+    }
 
-    // Create pipes for each child
-    for (int i = 0; i < NUM_CHILDREN; i++) {
-        if (pipe(pipes_to_child[i]) == -1) {
-            perror("Error creating pipe to child");
+    if (uses_pipes()) {
+        // Create pipes for each child
+        for (int i = 0; i < num_workers; i++) {
+            if (pipe(pipes_to_child[i]) == -1) {
+                perror("Error creating pipe to child");
+                exit(EXIT_FAILURE);
+            }
+            if (pipe(pipes_to_parent[i]) == -1) {
+                perror("Error creating pipe to parent");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    if (transport == TRANSPORT_SHM || wakeup == WAKE_FUTEX ||
+        (spin_ns > 0 && transport == TRANSPORT_PIPE && !use_uring)) {
+        // Map the rings and wakeup flags before forking so every child inherits them,
+        // populated up front so no frame pays the first touch of a ring page
+        channels = mmap(NULL, num_workers * sizeof(struct shm_channel), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (channels == MAP_FAILED) {
+            perror("Error mapping shared memory rings");
             exit(EXIT_FAILURE);
         }
-        if (pipe(pipes_to_parent[i]) == -1) {
-            perror("Error creating pipe to parent");
+    }
+    if (bulk_input_path) {
+        map_bulk_files();
+    }
+    for (int i = 0; i < num_workers && wakeup == WAKE_EVENTFD; i++) {
+        event_fds[i] = eventfd(0, 0);
+        if (event_fds[i] == -1) {
+            perror("Error creating eventfd");
             exit(EXIT_FAILURE);
         }
     }
 
+    // Block the operation signals so children can take them from a signalfd
+    // or sigwaitinfo() instead of a handler
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int i = 0; i < NUM_OPS; i++) {
+        sigaddset(&mask, signals[i]);
+        sigaddset(&mask, SIGRTMIN + i);
+    }
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    if (transport == TRANSPORT_THREAD) {
+        // Same pools and frames, but the workers share our address space
+        start_threads(child_pids);
+        pin_cpus(&parent_cpus);  // Only now, so the threads did not inherit it
+        parent_process(child_pids);
+        return 0;
+    }
+
     // Fork child processes and set up parent or child process based on fork result
-    for (int i = 0; i < NUM_CHILDREN; i++) {
+    for (int i = 0; i < num_workers; i++) {
         pid_t pid = fork();
         if (pid == -1) {
             perror("Error forking child process");
@@ -45,12 +825,13 @@ int main() {
             child_pids[i] = pid;
         }
     }
+    pin_cpus(&parent_cpus);  // Only now, so the children did not inherit it
 
     // Parent process handles user input and communication
     parent_process(child_pids);
 
     // Wait for child processes to finish
-    for (int i = 0; i < NUM_CHILDREN; i++) {
+    for (int i = 0; i < num_workers; i++) {
         wait(NULL);
     }
 
@@ -59,131 +840,3287 @@ int main() {
 
 void setup_child(int index) {
     child_index = index;
+    stats_slot = index;
+    pin_cpus(&worker_cpus[index]);
 
-    // Set up signal handler
-    if (index == 0) {
-        signal(SIGUSR1, handle_signal);  // Addition
-    } else if (index == 1) {
-        signal(SIGUSR2, handle_signal);  // Subtraction
-    } else if (index == 2) {
-        signal(SIGALRM, handle_signal);  // Multiplication
+    if (use_uring) {
+        close(uring.fd);  // The parent's ring
     }
+    if (uses_pipes()) {
+        // Close unused pipe ends
+        close(pipes_to_child[index][1]);    // Close write end to child
+        close(pipes_to_parent[index][0]);   // Close read end from child
 
-    // Close unused pipe ends
-    close(pipes_to_child[index][1]);    // Close write end to child
-    close(pipes_to_parent[index][0]);   // Close read end from child
+        // And every sibling's, so the parent sees EOF when one of us dies
+        for (int i = 0; i < num_workers; i++) {
+            if (i != index) {
+                close(pipes_to_child[i][0]);
+                close(pipes_to_child[i][1]);
+                close(pipes_to_parent[i][0]);
+                close(pipes_to_parent[i][1]);
+            }
+        }
+    }
+    if (listen_path || listen_port) {
+        // Ctrl-C reaches the whole process group; the server stops us once it has answered
+        signal(SIGINT, SIG_IGN);
+    }
+
+    if (transport == TRANSPORT_RTSIG) {
+        rtsig_loop(index);
+    }
+
+    if (wakeup == WAKE_SIGNAL) {
+        // The signal stays blocked and is consumed through a descriptor,
+        // so no work ever runs inside a signal handler
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, signals[worker_op[index]]);
+        signal_fd = signalfd(-1, &mask, 0);
+        if (signal_fd == -1) {
+            perror("Child: Error creating signalfd");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    // Wait for signal and perform calculation
+    // Event loop: drain everything that is queued, then sleep until woken.
+    // Work queued before the first wait is picked up by the first drain.
     while (1) {
-        pause();  // Wait for signal
+        drain_requests(index);
+        wait_for_work(index);
+
+        // Time from the parent's wakeup call until we are running again
+        long long stamp = atomic_exchange_explicit(&stats[index].wake_stamp, 0, memory_order_relaxed);
+        if (stamp) {
+            stat_add(STAGE_DELIVERY, stamp);
+        }
     }
 }
 
-void handle_signal(int signum) {
-    int nums[2];
-
-    // Read two integers from the parent
-    if (read(pipes_to_child[child_index][0], nums, sizeof(nums)) != sizeof(nums)) {
-        perror("Child: Error reading numbers");
+void start_threads(pid_t child_pids[]) {
+    // Cache-line aligned like the frames' columns
+    thread_requests = aligned_alloc(CACHE_LINE, FRAME_SLOTS * sizeof(struct request_frame));
+    thread_results = aligned_alloc(CACHE_LINE, FRAME_SLOTS * sizeof(struct result_frame));
+    if (!thread_requests || !thread_results) {
+        perror("Error allocating thread frames");
         exit(EXIT_FAILURE);
     }
+    // Touched now, so no frame pays for faulting in its slot
+    memset(thread_requests, 0, FRAME_SLOTS * sizeof(struct request_frame));
+    memset(thread_results, 0, FRAME_SLOTS * sizeof(struct result_frame));
+    for (int op = 0; op < NUM_OPS; op++) {
+        queue_init(&request_queues[op]);
+    }
+    queue_init(&completions);
 
-    int result;
-    // Perform the calculation based on the signal received
-    if (signum == SIGUSR1) {
-        result = nums[0] + nums[1];  // Addition
-    } else if (signum == SIGUSR2) {
-        result = nums[0] - nums[1];  // Subtraction
-    } else if (signum == SIGALRM) {
-        result = nums[0] * nums[1];  // Multiplication
-    } else {
-        fprintf(stderr, "Child: Received unknown signal\n");
-        exit(EXIT_FAILURE);
+    for (int i = 0; i < num_workers; i++) {
+        pthread_t thread;
+        int err = pthread_create(&thread, NULL, thread_loop, (void *)(intptr_t)i);
+        if (err != 0) {
+            errno = err;
+            perror("Error creating worker thread");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
     }
 
-    // Send the result back to the parent
-    if (write(pipes_to_parent[child_index][1], &result, sizeof(result)) != sizeof(result)) {
-        perror("Child: Error writing result");
-        exit(EXIT_FAILURE);
+    // Thread IDs stand in for child PIDs in the output
+    for (int i = 0; i < num_workers; i++) {
+        while (atomic_load(&thread_ids[i]) == 0) {
+            sched_yield();
+        }
+        child_pids[i] = atomic_load(&thread_ids[i]);
     }
 }
 
-void parent_process(pid_t child_pids[]) {
-    // Close unused pipe ends
-    for (int i = 0; i < NUM_CHILDREN; i++) {
-        close(pipes_to_child[i][0]);    // Close read end to child
-        close(pipes_to_parent[i][1]);   // Close write end from child
+void *thread_loop(void *arg) {
+    int index = (int)(intptr_t)arg;
+    int op = worker_op[index];
+
+    stats_slot = index;
+    pin_cpus(&worker_cpus[index]);
+    atomic_store(&thread_ids[index], (int)syscall(SYS_gettid));
+
+    // Stop requests go to the parent's thread, whose epoll_wait() they interrupt
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    // Any thread of the pool takes the next frame, so there is nothing to steal
+    while (1) {
+        int seq = queue_wait_pop(&request_queues[op]);
+        struct request_frame *frame = &thread_requests[seq % FRAME_SLOTS];
+        struct result_frame *done = &thread_results[seq % FRAME_SLOTS];
+
+        long long start = now_ns();
+        done->seq = seq;
+        done->worker = index;
+        if (frame->count == SLICE_FRAME) {
+            done->count = 1;
+            done->results[0] = compute_slice(frame->a[0], frame->b[0]);
+        } else {
+            done->count = frame->count;
+            compute_batch(op, frame->a, frame->b, done->results, frame->count);
+        }
+        stat_add(STAGE_COMPUTE, start);
+        atomic_store_explicit(&stats[index].requests,
+                              atomic_load_explicit(&stats[index].requests, memory_order_relaxed) +
+                                  (frame->count == SLICE_FRAME ? (unsigned)done->results[0] : (unsigned)frame->count),
+                              memory_order_relaxed);
+        queue_push(&completions, seq);
+    }
+    return NULL;
+}
+
+void queue_init(struct mpmc_queue *queue) {
+    for (unsigned i = 0; i < FRAME_SLOTS; i++) {
+        atomic_init(&queue->cells[i].sequence, i);
     }
+}
 
-    char input[BUFFER_SIZE];
-    int num1, num2;
-    char op;
+void queue_push(struct mpmc_queue *queue, int value) {
+    unsigned pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    int spins = 0;
 
+    // Claim the cell at enqueue_pos once its sequence shows it is free
     while (1) {
-        printf("Enter two integers and an operation (+, -, *) or 'q' to quit: ");
-        fgets(input, BUFFER_SIZE, stdin);
+        unsigned seq = atomic_load_explicit(&queue->cells[pos % FRAME_SLOTS].sequence, memory_order_acquire);
+        int diff = (int)(seq - pos);
+        if (diff == 0 && atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                                                               memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+        if (diff < 0) {
+            spin_wait(&spins);  // Full, which the in-flight limits should never allow
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        } else if (diff > 0) {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+    queue->cells[pos % FRAME_SLOTS].value = value;
+    atomic_store_explicit(&queue->cells[pos % FRAME_SLOTS].sequence, pos + 1, memory_order_release);
 
-        if (input[0] == 'q') {
+    // Pairs with the fence in queue_wait_pop: either the sleeper sees the value or we see the sleeper
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&queue->sleepers, memory_order_relaxed) > 0) {
+        atomic_fetch_add(&queue->wake_seq, 1);
+        syscall(SYS_futex, &queue->wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+int queue_pop(struct mpmc_queue *queue, int *value) {
+    unsigned pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+
+    while (1) {
+        unsigned seq = atomic_load_explicit(&queue->cells[pos % FRAME_SLOTS].sequence, memory_order_acquire);
+        int diff = (int)(seq - (pos + 1));
+        if (diff < 0) {
+            return 0;  // Empty
+        }
+        if (diff == 0 && atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                                                               memory_order_relaxed, memory_order_relaxed)) {
             break;
         }
+        if (diff > 0) {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+    *value = queue->cells[pos % FRAME_SLOTS].value;
+    atomic_store_explicit(&queue->cells[pos % FRAME_SLOTS].sequence, pos + FRAME_SLOTS, memory_order_release);
+    return 1;
+}
 
-        if (sscanf(input, "%d %d %c", &num1, &num2, &op) != 3) {
-            printf("Invalid input. Please try again.\n");
+int queue_ready(struct mpmc_queue *queue) {
+    unsigned pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    return atomic_load_explicit(&queue->cells[pos % FRAME_SLOTS].sequence, memory_order_acquire) == pos + 1;
+}
+
+int queue_wait_pop(struct mpmc_queue *queue) {
+    int value;
+
+    // Another consumer may take what woke us, so look again
+    while (!queue_pop(queue, &value)) {
+        queue_wait(queue);
+    }
+    return value;
+}
+
+void queue_wait(struct mpmc_queue *queue) {
+    // Returns once a value is ready to be popped, or on a spurious wakeup
+    unsigned seen = atomic_load(&queue->enqueue_pos);
+    if (queue_ready(queue)) {
+        return;
+    }
+    // A spinning consumer is not counted as a sleeper, so producers skip the futex wake
+    if (spin_ns > 0 && spin_for_change(&queue->enqueue_pos, seen) && queue_ready(queue)) {
+        return;
+    }
+    unsigned ticket = atomic_load(&queue->wake_seq);
+    atomic_fetch_add(&queue->sleepers, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!queue_ready(queue)) {
+        syscall(SYS_futex, &queue->wake_seq, FUTEX_WAIT_PRIVATE, ticket, NULL, NULL, 0);
+    }
+    atomic_fetch_sub(&queue->sleepers, 1);
+}
+
+int uses_pipes(void) {
+    return transport == TRANSPORT_PIPE || transport == TRANSPORT_RTSIG;
+}
+
+void drain_requests(int index) {
+    static struct request_frame frame;
+    int spins = 0;
+
+    while (1) {
+        long long start = now_ns();
+        unsigned seen = channels ? atomic_load(&channels[index].posted) : 0;
+        if (next_request(index, &frame)) {
+            stat_add(STAGE_READ, start);
+            process_frame(index, &frame);
+            spins = 0;
+            continue;
+        }
+        if (requests_pending(index)) {
+            spin_wait(&spins);  // A frame is only partly published, or a sibling beat us to it
             continue;
         }
+        if (!channels) {
+            return;  // The parent wakes us after every frame
+        }
+        // Poll for a while before announcing the sleep: work that arrives
+        // meanwhile costs the parent no wakeup and us no blocking call
+        if (spin_ns > 0 && spin_for_change(&channels[index].posted, seen)) {
+            continue;
+        }
+        // Announce the sleep first, then look again: either we see the new
+        // work or the parent sees the flag and wakes us
+        atomic_store(&channels[index].waiting, 1);
+        if (!requests_pending(index)) {
+            return;
+        }
+        atomic_store(&channels[index].waiting, 0);
+    }
+}
 
-        int index;
-        int signum;
+int requests_pending(int index) {
+    if (transport == TRANSPORT_SHM) {
+        struct shm_ring *ring = &channels[index].requests;
+        return atomic_load(&ring->tail) != atomic_load(&ring->head);
+    }
 
-        // Determine which child process to use based on the operation
-        if (op == '+') {
-            index = 0;
-            signum = SIGUSR1;
-        } else if (op == '-') {
-            index = 1;
-            signum = SIGUSR2;
-        } else if (op == '*') {
-            index = 2;
-            signum = SIGALRM;
-        } else {
-            printf("Invalid operation. Please use +, -, or *.\n");
-            continue;
+    int bytes;
+    if (ioctl(pipes_to_child[index][0], FIONREAD, &bytes) == -1) {
+        perror("Child: Error polling pipe");
+        exit(EXIT_FAILURE);
+    }
+    return bytes > 0;
+}
+
+int next_request(int index, struct request_frame *frame) {
+    if (transport == TRANSPORT_SHM) {
+        if (ring_take_frame(&channels[index].requests, frame)) {
+            return 1;
         }
 
-        // Send data to the appropriate child process
-        int nums[2] = {num1, num2};
-        if (write(pipes_to_child[index][1], nums, sizeof(nums)) != sizeof(nums)) {
-            perror("Parent: Error writing numbers to child");
-            continue;
+        // Own queue is empty: steal a queued frame from a busy sibling in the pool
+        int op = worker_op[index];
+        for (int w = first_worker[op]; w < first_worker[op] + pool_size[op]; w++) {
+            if (w != index && ring_take_frame(&channels[w].requests, frame)) {
+                return 1;
+            }
         }
+        return 0;
+    }
 
-        // Signal child to perform calculation
-        printf("The child process with PID: %d will provide the result.\n", child_pids[index]);
-        if (kill(child_pids[index], signum) == -1) {
-            perror("Parent: Error sending signal to child");
-            continue;
+    if (!requests_pending(index)) {
+        return 0;
+    }
+
+    // Read a frame from the parent, each column straight into place
+    if (read_full(pipes_to_child[index][0], &frame->seq, 2 * sizeof(int)) == -1 ||
+        frame_pairs(frame->count) < 1) {
+        perror("Child: Error reading numbers");
+        exit(EXIT_FAILURE);
+    }
+    struct iovec columns[2] = {{frame->a, frame_pairs(frame->count) * sizeof(int)},
+                               {frame->b, frame_pairs(frame->count) * sizeof(int)}};
+    if (readv_full(pipes_to_child[index][0], columns, 2) == -1) {
+        perror("Child: Error reading numbers");
+        exit(EXIT_FAILURE);
+    }
+    return 1;
+}
+
+int ring_take_frame(struct shm_ring *ring, struct request_frame *frame) {
+    // Request rings have one producer but several consumers once siblings
+    // steal, so a frame is copied out first and then claimed by moving head
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned avail = atomic_load_explicit(&ring->tail, memory_order_acquire) - head;
+    if (avail < 2) {
+        return 0;
+    }
+
+    frame->seq = ring->words[head & (RING_WORDS - 1)];
+    frame->count = ring->words[(head + 1) & (RING_WORDS - 1)];
+    int pairs = frame_pairs(frame->count);
+    unsigned size = 2 + 2 * pairs;
+    if (pairs < 1 || avail < size) {
+        return 0;  // Stale read after losing a race, or not fully published yet
+    }
+    for (int i = 0; i < pairs; i++) {
+        frame->a[i] = ring->words[(head + 2 + i) & (RING_WORDS - 1)];
+        frame->b[i] = ring->words[(head + 2 + pairs + i) & (RING_WORDS - 1)];
+    }
+    return atomic_compare_exchange_strong(&ring->head, &head, head + size);
+}
+
+void process_frame(int index, struct request_frame *frame) {
+    static struct result_frame done;
+
+    long long start = now_ns();
+    done.seq = frame->seq;
+    done.worker = index;
+    if (frame->count == SLICE_FRAME) {
+        // Results go straight into the output mapping, only the tally comes back
+        done.count = 1;
+        done.results[0] = compute_slice(frame->a[0], frame->b[0]);
+    } else {
+        done.count = frame->count;
+        compute_batch(worker_op[index], frame->a, frame->b, done.results, frame->count);
+    }
+    stat_add(STAGE_COMPUTE, start);
+    atomic_store_explicit(&stats[index].requests,
+                          atomic_load_explicit(&stats[index].requests, memory_order_relaxed) +
+                              (frame->count == SLICE_FRAME ? (unsigned)done.results[0] : (unsigned)frame->count),
+                          memory_order_relaxed);
+
+    // Send the results back to the parent
+    start = now_ns();
+    if (transport == TRANSPORT_SHM) {
+        ring_push(&channels[index].results, &done.seq, 3);
+        ring_push(&channels[index].results, done.results, done.count);
+    } else {
+        struct iovec reply[2] = {{&done.seq, 3 * sizeof(int)}, {done.results, done.count * sizeof(int)}};
+        if (writev_full(pipes_to_parent[index][1], reply, 2) == -1) {
+            perror("Child: Error writing result");
+            exit(EXIT_FAILURE);
         }
+    }
+    stat_add(STAGE_REPLY, start);
+}
 
-        // Read result from child
-        int result;
-        if (read(pipes_to_parent[index][0], &result, sizeof(result)) != sizeof(result)) {
-            perror("Parent: Error reading result from child");
-            continue;
+int compute_slice(int start, int end) {
+    int a[NUM_OPS][SLICE_RUN];
+    int b[NUM_OPS][SLICE_RUN];
+    int at[NUM_OPS][SLICE_RUN];  // Record each gathered pair came from
+    int gathered[NUM_OPS] = {0};
+    int computed = 0;
+
+    // The slice is ours alone and is read once: its records are gathered into
+    // columns per operation, and each full column takes one kernel call
+    for (int i = start; i < end; i++) {
+        int op = code_ops[bulk_records[i].op] - 1;
+        if (op < 0) {
+            continue;  // Unknown code, its result stays 0
+        }
+        int n = gathered[op];
+        a[op][n] = bulk_records[i].nums[0];
+        b[op][n] = bulk_records[i].nums[1];
+        at[op][n] = i;
+        if (b[op][n] == 0 && (op == OP_DIV || op == OP_MOD)) {
+            continue;  // Division by zero, likewise left at 0
         }
+        computed++;
+        if (++gathered[op] == SLICE_RUN) {
+            compute_run(op, a[op], b[op], at[op], SLICE_RUN);
+            gathered[op] = 0;
+        }
+    }
+    for (int op = 0; op < NUM_OPS; op++) {
+        compute_run(op, a[op], b[op], at[op], gathered[op]);
+    }
+    return computed;
+}
 
-        // Display result
-        printf("Result: %d\n\n", result);
+void compute_run(int op, const int *a, const int *b, const int *at, int count) {
+    int results[SLICE_RUN];
+
+    // Scatter the column's results back to the records they belong to
+    if (count > 0) {
+        compute_batch(op, a, b, results, count);
+        for (int i = 0; i < count; i++) {
+            bulk_results[at[i]] = results[i];
+        }
     }
+}
 
-    // Close pipes
-    for (int i = 0; i < NUM_CHILDREN; i++) {
-        close(pipes_to_child[i][1]);
-        close(pipes_to_parent[i][0]);
+void wait_for_work(int index) {
+    if (wakeup == WAKE_SIGNAL) {
+        struct signalfd_siginfo info;
+        if (read(signal_fd, &info, sizeof(info)) == -1 && errno != EINTR) {
+            perror("Child: Error reading signalfd");
+            exit(EXIT_FAILURE);
+        }
+    } else if (wakeup == WAKE_EVENTFD) {
+        uint64_t count;
+        if (read(event_fds[index], &count, sizeof(count)) == -1 && errno != EINTR) {
+            perror("Child: Error reading eventfd");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        // Returns at once if the parent already cleared the flag
+        if (syscall(SYS_futex, &channels[index].waiting, FUTEX_WAIT, 1, NULL, NULL, 0) == -1 &&
+            errno != EAGAIN && errno != EINTR) {
+            perror("Child: Error waiting on futex");
+            exit(EXIT_FAILURE);
+        }
     }
+}
 
-    // Terminate child processes
-    for (int i = 0; i < NUM_CHILDREN; i++) {
-        kill(child_pids[i], SIGTERM);
+void rtsig_loop(int index) {
+    static _Alignas(CACHE_LINE) int a[BATCH_MAX];
+    static _Alignas(CACHE_LINE) int b[BATCH_MAX];
+    static _Alignas(CACHE_LINE) int results[BATCH_MAX];
+    struct timespec no_wait = {0, 0};
+    sigset_t mask;
+    siginfo_t info;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGRTMIN + worker_op[index]);
+
+    while (1) {
+        // Real-time signals queue, so each one carries exactly one request
+        if (sigwaitinfo(&mask, &info) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Child: Error waiting for signal");
+            exit(EXIT_FAILURE);
+        }
+        long long stamp = atomic_exchange_explicit(&stats[index].wake_stamp, 0, memory_order_relaxed);
+        if (stamp) {
+            stat_add(STAGE_DELIVERY, stamp);
+        }
+
+        // Take whatever else is already queued and answer it in one write.
+        // Results go back bare, the parent knows which frame is outstanding.
+        long long start = now_ns();
+        int count = 0;
+        do {
+            uint64_t packed = (uintptr_t)info.si_value.sival_ptr;
+            a[count] = (int32_t)(packed >> 32);
+            b[count] = (int32_t)packed;
+            count++;
+        } while (count < BATCH_MAX && sigtimedwait(&mask, &info, &no_wait) != -1);
+        stat_add(STAGE_READ, start);
+
+        start = now_ns();
+        compute_batch(worker_op[index], a, b, results, count);
+        stat_add(STAGE_COMPUTE, start);
+        atomic_store_explicit(&stats[index].requests,
+                              atomic_load_explicit(&stats[index].requests, memory_order_relaxed) + count,
+                              memory_order_relaxed);
+
+        start = now_ns();
+        if (write_full(pipes_to_parent[index][1], results, count * sizeof(results[0])) == -1) {
+            perror("Child: Error writing result");
+            exit(EXIT_FAILURE);
+        }
+        stat_add(STAGE_REPLY, start);
+    }
+}
+
+void compute_batch(int op, const int *a, const int *b, int *results, int count) {
+    // Perform the calculation this child is responsible for
+    op_kernels[op](a, b, results, count);
+}
+
+void select_kernel(const char *name) {
+    // Default to the widest kernels the CPU runs, or honour an explicit choice.
+    // Operations without a vector kernel keep the scalar one.
+    int level = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (!name && __builtin_cpu_supports("avx2")) {
+        level = 2;
+    } else if (!name && __builtin_cpu_supports("sse2")) {
+        level = 1;
+    } else if (name && strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        level = 2;
+    } else if (name && strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        level = 1;
+    }
+#endif
+    if (name && strcmp(name, "scalar") != 0 && level == 0) {
+        fprintf(stderr, "Kernel '%s' is not available on this CPU\n", name);
+        exit(EXIT_FAILURE);
+    }
+    for (int op = 0; op < NUM_OPS; op++) {
+        op_kernels[op] = operations[op].scalar;
+        if (level >= 1 && operations[op].sse2) {
+            op_kernels[op] = operations[op].sse2;
+        }
+        if (level >= 2 && operations[op].avx2) {
+            op_kernels[op] = operations[op].avx2;
+        }
+    }
+}
+
+void setup_operations(void) {
+    // Lookup tables for the parsers, and the list of symbols for messages
+    char *list = op_list;
+    for (int op = 0; op < NUM_OPS; op++) {
+        const char *symbol = operations[op].symbol;
+        if (symbol[1] == '\0') {
+            symbol_ops[(unsigned char)symbol[0]] = op + 1;
+        }
+        code_ops[(unsigned char)operations[op].code] = op + 1;
+        list += sprintf(list, "%s%s", op == 0 ? "" : op == NUM_OPS - 1 ? ", or " : ", ", symbol);
+        pool_size[op] = 1;
+    }
+    snprintf(bad_op_text, sizeof(bad_op_text), "Invalid operation. Please use %s.\n", op_list);
+
+    // The first three keep their classic signals, the rest take real-time
+    // signals above the ones TRANSPORT_RTSIG uses
+    int classic[] = {SIGUSR1, SIGUSR2, SIGALRM};
+    for (int op = 0; op < NUM_OPS; op++) {
+        signals[op] = op < 3 ? classic[op] : SIGRTMIN + NUM_OPS + op;
+    }
+    if (SIGRTMIN + 2 * NUM_OPS > SIGRTMAX) {
+        fprintf(stderr, "Not enough real-time signals for %d operations\n", NUM_OPS);
+        exit(EXIT_FAILURE);
     }
 }
 
+size_t match_operation(const char *p, const char *end, int *op) {
+    // Symbols are one byte and looked up directly; only words are compared in turn
+    if (p == end) {
+        return 0;
+    }
+    if (symbol_ops[(unsigned char)*p]) {
+        *op = symbol_ops[(unsigned char)*p] - 1;
+        return 1;
+    }
+    for (int i = 0; i < NUM_OPS; i++) {
+        size_t len = strlen(operations[i].symbol);
+        if (len > 1 && (size_t)(end - p) >= len && memcmp(p, operations[i].symbol, len) == 0) {
+            *op = i;
+            return len;
+        }
+    }
+    return 0;
+}
+
+int divide(int a, int b) {
+    if (b == 0) {
+        return 0;  // Never asked for, but must not trap in a worker
+    }
+    return b == -1 ? (int)(0u - (unsigned)a) : a / b;
+}
+
+int modulo(int a, int b) {
+    if (b == 0) {
+        return 0;  // Never asked for, but must not trap in a worker
+    }
+    return b == -1 ? 0 : a % b;
+}
+
+int power(int a, int b) {
+    if (b < 0) {
+        return a == 1 ? 1 : a == -1 ? (b & 1 ? -1 : 1) : 0;
+    }
+    // Square and multiply, wrapping like the other operations
+    unsigned result = 1;
+    unsigned base = a;
+    for (; b > 0; b >>= 1) {
+        if (b & 1) {
+            result *= base;
+        }
+        base *= base;
+    }
+    return result;
+}
+
+// Scalar kernels. a and b are unsigned so +, - and * wrap like the vector
+// kernels instead of overflowing; the signed operations convert back.
+#define SCALAR_KERNEL(name, expr)                                                   \
+    void scalar_##name(const int *x, const int *y, int *results, int count) {       \
+        for (int i = 0; i < count; i++) {                                           \
+            unsigned a = x[i];                                                      \
+            unsigned b = y[i];                                                      \
+            results[i] = (expr);                                                    \
+        }                                                                           \
+    }
+
+SCALAR_KERNEL(add, a + b)
+SCALAR_KERNEL(sub, a - b)
+SCALAR_KERNEL(mul, a * b)
+SCALAR_KERNEL(div, divide(a, b))
+SCALAR_KERNEL(mod, modulo(a, b))
+SCALAR_KERNEL(pow, power(a, b))
+SCALAR_KERNEL(min, (int)a < (int)b ? a : b)
+SCALAR_KERNEL(max, (int)a > (int)b ? a : b)
+SCALAR_KERNEL(and, a & b)
+SCALAR_KERNEL(xor, a ^ b)
+SCALAR_KERNEL(or, a | b)
+
+#if defined(__x86_64__) || defined(__i386__)
+// Four pairs per step, one load from each column
+#define SSE2_KERNEL(name, expr)                                                                                 \
+    __attribute__((target("sse2"))) void sse2_##name(const int *x, const int *y, int *results, int count) {     \
+        int i = 0;                                                                                              \
+        for (; i + 4 <= count; i += 4) {                                                                        \
+            __m128i a = _mm_loadu_si128((const __m128i *)&x[i]);                                                \
+            __m128i b = _mm_loadu_si128((const __m128i *)&y[i]);                                                \
+            _mm_storeu_si128((__m128i *)&results[i], (expr));                                                   \
+        }                                                                                                       \
+        scalar_##name(x + i, y + i, results + i, count - i);                                                    \
+    }
+
+// No 32-bit multiply in SSE2: multiply even and odd lanes separately, keep the low halves
+#define SSE2_MULLO(a, b)                                                                        \
+    _mm_unpacklo_epi32(_mm_shuffle_epi32(_mm_mul_epu32(a, b), 0x08),                            \
+                       _mm_shuffle_epi32(_mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32)), 0x08))
+
+// Nor a 32-bit min or max: select through a comparison mask
+#define SSE2_SELECT(mask, x, y) _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y))
+
+SSE2_KERNEL(add, _mm_add_epi32(a, b))
+SSE2_KERNEL(sub, _mm_sub_epi32(a, b))
+SSE2_KERNEL(mul, SSE2_MULLO(a, b))
+SSE2_KERNEL(min, SSE2_SELECT(_mm_cmpgt_epi32(a, b), b, a))
+SSE2_KERNEL(max, SSE2_SELECT(_mm_cmpgt_epi32(a, b), a, b))
+SSE2_KERNEL(and, _mm_and_si128(a, b))
+SSE2_KERNEL(xor, _mm_xor_si128(a, b))
+SSE2_KERNEL(or, _mm_or_si128(a, b))
+
+// Eight pairs per step, one load from each column
+#define AVX2_KERNEL(name, expr)                                                                                 \
+    __attribute__((target("avx2"))) void avx2_##name(const int *x, const int *y, int *results, int count) {     \
+        int i = 0;                                                                                              \
+        for (; i + 8 <= count; i += 8) {                                                                        \
+            __m256i a = _mm256_loadu_si256((const __m256i *)&x[i]);                                             \
+            __m256i b = _mm256_loadu_si256((const __m256i *)&y[i]);                                             \
+            _mm256_storeu_si256((__m256i *)&results[i], (expr));                                                \
+        }                                                                                                       \
+        scalar_##name(x + i, y + i, results + i, count - i);                                                    \
+    }
+
+AVX2_KERNEL(add, _mm256_add_epi32(a, b))
+AVX2_KERNEL(sub, _mm256_sub_epi32(a, b))
+AVX2_KERNEL(mul, _mm256_mullo_epi32(a, b))
+AVX2_KERNEL(min, _mm256_min_epi32(a, b))
+AVX2_KERNEL(max, _mm256_max_epi32(a, b))
+AVX2_KERNEL(and, _mm256_and_si256(a, b))
+AVX2_KERNEL(xor, _mm256_xor_si256(a, b))
+AVX2_KERNEL(or, _mm256_or_si256(a, b))
+#endif
+
+void parent_process(pid_t child_pids[]) {
+    // Close unused pipe ends
+    for (int i = 0; i < num_workers && uses_pipes(); i++) {
+        close(pipes_to_child[i][0]);    // Close read end to child
+        close(pipes_to_parent[i][1]);   // Close write end from child
+    }
+
+    if (offload_policy == OFFLOAD_AUTO && !probe_count && !bulk_input_path) {
+        calibrate_offload(child_pids);
+    }
+
+    if (probe_count) {
+        latency_probe(child_pids);
+    } else if (bulk_input_path) {
+        bulk_job(child_pids);
+    } else if (listen_path || listen_port) {
+        server_loop(child_pids);
+    } else if (batch_mode) {
+        batch_loop(child_pids);
+    } else {
+        interactive_loop(child_pids);
+    }
+
+    // Close pipes
+    for (int i = 0; i < num_workers && uses_pipes(); i++) {
+        close(pipes_to_child[i][1]);
+        close(pipes_to_parent[i][0]);
+    }
+
+    // Terminate child processes; worker threads end with the process
+    for (int i = 0; i < num_workers && transport != TRANSPORT_THREAD; i++) {
+        kill(child_pids[i], SIGTERM);
+    }
+}
+
+void interactive_loop(pid_t child_pids[]) {
+    static struct request_frame frame;
+    char input[BUFFER_SIZE];
+    int terminal = isatty(STDIN_FILENO);
+
+    if (expression_mode) {
+        prepare_output(child_pids);
+        watch_results();
+    }
+
+    while (1) {
+        if (expression_mode) {
+            printf("Enter an expression or 'q' to quit: ");
+        } else {
+            printf("Enter two integers and an operation (%s) or 'q' to quit: ", op_list);
+        }
+
+        // Wait in poll() only once stdio has handed out every line it read:
+        // a SIGQUIT then interrupts the wait and is answered right away
+        if (terminal && stdin_drained()) {
+            fflush(stdout);
+            struct pollfd readable = {.fd = STDIN_FILENO, .events = POLLIN};
+            if (poll(&readable, 1, -1) == -1 && errno == EINTR) {
+                if (stats_requested) {
+                    dump_stats();
+                }
+                continue;
+            }
+        }
+        if (!fgets(input, BUFFER_SIZE, stdin)) {
+            break;
+        }
+        input_lines++;
+
+        size_t len = strlen(input);
+        if (len == BUFFER_SIZE - 1 && input[len - 1] != '\n') {
+            // Drop the rest of an over-long line instead of reading it as the next request
+            int c;
+            while ((c = getchar()) != EOF && c != '\n') {
+            }
+            report_line(NULL, NULL, "line too long");
+            printf("Invalid input. Please try again.\n");
+            continue;
+        }
+
+        if (input[0] == 'q') {
+            break;
+        }
+        if (stats_requested) {
+            dump_stats();  // Arrived while fgets() was restarted; the line is still a request
+        }
+        if (strcmp(input, "s\n") == 0) {
+            dump_stats();
+            continue;
+        }
+        if (expression_mode) {
+            // Expressions go through the batch pipeline, one line at a time
+            fflush(stdout);
+            queue_line(child_pids, input, len);
+            finish_pending(child_pids);
+            continue;
+        }
+
+        int op;
+        int nums[2];
+        int kind = parse_request(input, len, nums, &op);
+        if (kind == LINE_BAD_INPUT) {
+            printf(compact_output ? "E invalid input\n" : "Invalid input. Please try again.\n");
+            continue;
+        } else if (kind == LINE_BAD_OP) {
+            printf("%s", compact_output ? "E invalid operation\n" : bad_op_text);
+            continue;
+        }
+
+        // Answer a repeated request from the cache, naming the child that computed it
+        struct result_frame done = {.seq = 0, .count = 1};
+        frame.a[0] = nums[0];
+        frame.b[0] = nums[1];
+        if (cache_lookup(op, nums[0], nums[1], &done.results[0], &done.worker)) {
+            // Answered without any IPC
+        } else if (should_inline(op, 1)) {
+            long long start = parent_cpu_ns();
+            compute_batch(op, frame.a, frame.b, done.results, 1);
+            inline_pair_ns[op] += (cpu_since(start) - inline_pair_ns[op]) / 8;
+            done.worker = -1;
+            inlined_frames++;
+            cache_insert(op, nums[0], nums[1], done.results[0], -1);
+        } else {
+            // Send a single-request frame and signal the child
+            int index = pick_worker(op);
+            frame.seq = 0;
+            frame.count = 1;
+            done.worker = index;
+            long long cost = time_offload(child_pids, index, &frame, &done);
+            offload_frame_ns += (cost - offload_pair_ns - offload_frame_ns) / 8;
+            offloaded_frames++;
+            cache_insert(op, nums[0], nums[1], done.results[0], index);
+        }
+
+        // Display result
+        if (compact_output) {
+            printf("%d\n", done.results[0]);
+        } else if (done.worker == -1) {
+            printf("Result: %d\n\n", done.results[0]);  // Computed by the parent, no child to name
+        } else {
+            printf("The child process with PID: %d will provide the result.\n", child_pids[done.worker]);
+            printf("Result: %d\n\n", done.results[0]);
+        }
+    }
+}
+
+int stdin_drained(void) {
+#ifdef __GLIBC__
+    // Bytes stdio read from the descriptor but has not returned yet
+    return stdin->_IO_read_ptr >= stdin->_IO_read_end;
+#else
+    return 0;  // Cannot tell, so never wait with a line possibly buffered
+#endif
+}
+
+void batch_loop(pid_t child_pids[]) {
+    static char input[INPUT_CHUNK];
+    size_t used = 0;
+    int eof = 0;
+    int quit = 0;
+    int skipping = 0;  // Discarding the rest of an over-long line
+
+    prepare_output(child_pids);
+    watch_results();
+
+    while (!eof && !quit) {
+        // When the input stalls, answer everything read so far instead of
+        // holding it back, so a writer waiting on our output is not stuck
+        struct pollfd input_poll = {.fd = STDIN_FILENO, .events = POLLIN};
+        if (poll(&input_poll, 1, 0) == 0) {
+            finish_pending(child_pids);
+        }
+
+        ssize_t n = read(STDIN_FILENO, input + used, INPUT_CHUNK - used);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Parent: Error reading input");
+            break;
+        }
+        eof = n == 0;
+        used += n;
+
+        // Queue every complete line in the block
+        char *start = input;
+        char *end = input + used;
+        while (start < end && !quit) {
+            char *newline = memchr(start, '\n', end - start);
+            if (!newline) {
+                if (eof) {
+                    newline = end;  // Last line without a newline
+                } else if (start == input && used == INPUT_CHUNK) {
+                    // Line longer than the whole buffer, reject it and drop the rest
+                    if (!skipping) {
+                        input_lines++;
+                        report_line(NULL, NULL, "line too long");
+                        queue_line(child_pids, NULL, 0);
+                    }
+                    skipping = 1;
+                    start = end;
+                    break;
+                } else {
+                    break;  // Keep the partial line for the next read
+                }
+            }
+            *newline = '\0';
+            if (skipping) {
+                // The tail of a rejected line, counted when it was rejected
+                skipping = 0;
+                start = newline + 1;
+                continue;
+            }
+            input_lines++;
+            if (start[0] == 'q') {
+                quit = 1;
+            } else if (strcmp(start, "s") == 0) {
+                dump_stats();
+            } else {
+                queue_line(child_pids, start, newline - start);
+            }
+            start = newline + 1;
+        }
+
+        // Move the unconsumed tail to the front of the buffer
+        used = start < end ? (size_t)(end - start) : 0;
+        memmove(input, start, used);
+
+        // Hand partial frames to idle workers so they work while the next block is read
+        schedule_nodes(child_pids);
+        dispatch_ready(child_pids);
+        collect_results(0);
+        write_output(child_pids);
+    }
+
+    finish_pending(child_pids);
+    if (uses_pipes() && !uring_active) {
+        close(epoll_fd);
+    }
+}
+
+void watch_results(void) {
+    for (int i = 0; i < num_workers; i++) {
+        result_credit[i] = RESULT_CREDIT;
+    }
+    if (use_uring) {
+        uring_start();
+        return;
+    }
+
+    // Completions from every child are gathered through one epoll set
+    if (!uses_pipes()) {
+        return;
+    }
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd == -1) {
+        perror("Parent: Error creating epoll instance");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        struct epoll_event event = {.events = EPOLLIN, .data.u32 = i};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pipes_to_parent[i][0], &event) == -1) {
+            perror("Parent: Error watching pipe");
+            exit(EXIT_FAILURE);
+        }
+
+        // Pipes can be far smaller than the default, e.g. past pipe-user-pages-soft
+        int capacity = fcntl(pipes_to_parent[i][0], F_GETPIPE_SZ);
+        if (capacity > 0 && capacity / 2 < result_credit[i]) {
+            result_credit[i] = capacity / 2;
+        }
+    }
+
+    // From here on a full request pipe queues instead of stalling the parent,
+    // which keeps collecting results from every other child meanwhile
+    for (int i = 0; i < num_workers && transport == TRANSPORT_PIPE && !use_outboxes; i++) {
+        outboxes[i].data = malloc(OUTBOX_BYTES);
+        if (!outboxes[i].data || fcntl(pipes_to_child[i][1], F_SETFL, O_NONBLOCK) == -1) {
+            perror("Parent: Error setting up request queues");
+            exit(EXIT_FAILURE);
+        }
+    }
+    use_outboxes = transport == TRANSPORT_PIPE;
+}
+
+void map_bulk_files(void) {
+    struct stat st;
+
+    // Mapped before fork() so the children read the records and write the
+    // results through the same pages, nothing is parsed or copied
+    int in = open(bulk_input_path, O_RDONLY);
+    if (in == -1 || fstat(in, &st) == -1) {
+        perror("Error opening bulk input");
+        exit(EXIT_FAILURE);
+    }
+    if (st.st_size % sizeof(struct bulk_record) != 0 ||
+        st.st_size / sizeof(struct bulk_record) > (size_t)INT32_MAX) {
+        fprintf(stderr, "%s does not hold a whole number of %zu-byte records\n", bulk_input_path,
+                sizeof(struct bulk_record));
+        exit(EXIT_FAILURE);
+    }
+    bulk_count = st.st_size / sizeof(struct bulk_record);
+
+    int out = open(bulk_output_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out == -1 || ftruncate(out, (off_t)bulk_count * sizeof(int32_t)) == -1) {
+        perror("Error creating bulk output");
+        exit(EXIT_FAILURE);
+    }
+
+    if (bulk_count > 0) {
+        bulk_records = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, in, 0);
+        bulk_results = mmap(NULL, (size_t)bulk_count * sizeof(int32_t), PROT_READ | PROT_WRITE, MAP_SHARED, out, 0);
+        if (bulk_records == MAP_FAILED || bulk_results == MAP_FAILED) {
+            perror("Error mapping bulk files");
+            exit(EXIT_FAILURE);
+        }
+        madvise(bulk_records, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(in);
+    close(out);
+}
+
+void bulk_job(pid_t child_pids[]) {
+    int slices = (bulk_count + SLICE_RECORDS - 1) / SLICE_RECORDS;
+
+    watch_results();
+
+    // Every slice goes to one worker, which computes all of its records. Any pool
+    // will do, so take the one with the least outstanding per worker and leave
+    // the worker within it to dispatch_frame()
+    for (int slice = 0; slice < slices; slice++) {
+        int op = -1;
+        int op_owed = 0;
+        for (int i = 0; i < NUM_OPS; i++) {
+            int pool = (slice + i) % NUM_OPS;
+            int owed = 0;
+            for (int w = first_worker[pool]; w < first_worker[pool] + pool_size[pool]; w++) {
+                owed += frames_in_flight[w];
+            }
+            if (op == -1 || owed * pool_size[op] < op_owed * pool_size[pool]) {
+                op = pool;
+                op_owed = owed;
+            }
+        }
+        struct request_frame *frame = &open_frames[op];
+        frame->seq = claim_seq(child_pids, op);
+        frame->count = SLICE_FRAME;
+        frame->a[0] = slice * SLICE_RECORDS;
+        frame->b[0] = slice == slices - 1 ? bulk_count : (slice + 1) * SLICE_RECORDS;
+        dispatch_frame(child_pids, op);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        while (frames_in_flight[i] > 0) {
+            collect_results(1);
+        }
+    }
+
+    if (bulk_count > 0 && msync(bulk_results, (size_t)bulk_count * sizeof(int32_t), MS_SYNC) == -1) {
+        perror("Parent: Error writing bulk output");
+        exit(EXIT_FAILURE);
+    }
+    printf("Records: %d, computed %lld, invalid operation or division by zero %lld\n", bulk_count, bulk_computed,
+           bulk_count - bulk_computed);
+    if (uses_pipes() && !uring_active) {
+        close(epoll_fd);
+    }
+}
+
+void queue_line(pid_t child_pids[], const char *line, size_t len) {
+    make_room(child_pids, expression_mode ? len + 1 : 0);
+
+    struct line_entry *entry = &window[next_line % WINDOW_LINES];
+    entry->first_node = next_node;
+    entry->num_nodes = 0;
+    entry->number = input_lines;
+    if (!line) {
+        entry->kind = LINE_BAD_INPUT;
+    } else if (expression_mode) {
+        entry->kind = queue_expression(child_pids, entry, line, len);
+    } else {
+        entry->kind = parse_request(line, len, entry->nums, &entry->index);
+        if (entry->kind == LINE_RESULT) {
+            queue_pair(child_pids, entry);
+            next_line++;
+            return;
+        }
+    }
+    entry->done = entry->kind != LINE_RESULT;
+    if (!entry->done && expression_mode) {
+        // A bare number needs no worker, everything else waits for its nodes
+        struct expr_node *root = &nodes[entry->root % EXPR_NODES];
+        entry->kind = root->state == NODE_UNDEFINED ? LINE_BAD_INPUT : LINE_RESULT;
+        entry->done = root->state == NODE_DONE || root->state == NODE_UNDEFINED;
+        entry->index = -1;
+        entry->result = root->value;
+    }
+    next_line++;
+}
+
+void queue_request(pid_t child_pids[], int op, unsigned tag, int a, int b) {
+    // Append to the operation's open frame, sending it once full
+    struct request_frame *frame = &open_frames[op];
+    if (frame->count == 0) {
+        frame->seq = claim_seq(child_pids, op);
+        frame_opened[op] = linger_ns > 0 ? now_ns() : 0;
+    }
+    inflight[frame->seq % FRAME_SLOTS].lines[frame->count] = tag;
+    frame->a[frame->count] = a;
+    frame->b[frame->count] = b;
+    if (++frame->count == batch_limit) {
+        dispatch_frame(child_pids, op);
+    }
+}
+
+void queue_pair(pid_t child_pids[], struct line_entry *entry) {
+    // The next line's pair, answered from the cache or sent to its operation's pool
+    if (cache_lookup(entry->index, entry->nums[0], entry->nums[1], &entry->result, &entry->index)) {
+        entry->done = 1;
+    } else {
+        entry->done = 0;
+        queue_request(child_pids, entry->index, next_line, entry->nums[0], entry->nums[1]);
+    }
+}
+
+void server_loop(pid_t child_pids[]) {
+    struct epoll_event events[64];
+    int num_listeners = 0;
+
+    clients = malloc(MAX_CLIENTS * sizeof(struct client));
+    server_epoll = epoll_create1(0);
+    if (!clients || server_epoll == -1) {
+        perror("Parent: Error setting up server");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+        clients[i].generation = 0;
+        clients[i].dirty = 0;
+        clients[i].tx = NULL;
+        clients[i].tx_size = 0;
+    }
+
+    if (listen_path) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(listen_path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", listen_path);
+            exit(EXIT_FAILURE);
+        }
+        strcpy(addr.sun_path, listen_path);
+        unlink(listen_path);  // Left behind by an earlier run
+        listen_fds[num_listeners++] = open_listener(AF_UNIX, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    if (listen_port) {
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(listen_port)};
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        listen_fds[num_listeners++] = open_listener(AF_INET, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    for (int i = 0; i < num_listeners; i++) {
+        struct epoll_event event = {.events = EPOLLIN, .data.u32 = MAX_CLIENTS + i};
+        if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, listen_fds[i], &event) == -1) {
+            perror("Parent: Error watching listener");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (linger_ns > 0) {
+        // Partial frames may wait for company, but not past their deadline
+        linger_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        struct epoll_event event = {.events = EPOLLIN, .data.u32 = MAX_CLIENTS + 2};
+        if (linger_timer == -1 || epoll_ctl(server_epoll, EPOLL_CTL_ADD, linger_timer, &event) == -1) {
+            perror("Parent: Error setting up linger timer");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // SIGINT and SIGTERM stop the server after answering what was already read
+    struct sigaction sa;
+    sa.sa_handler = handle_stop_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    prepare_output(child_pids);
+    watch_results();
+
+    while (!server_stopping) {
+        // Only sleep on the sockets when no worker has anything to report
+        int n = epoll_wait(server_epoll, events, 64, frames_outstanding > 0 ? 0 : -1);
+        if (n == -1 && errno == EINTR) {
+            if (stats_requested) {
+                dump_stats();
+            }
+            continue;
+        }
+        if (n == -1) {
+            perror("Parent: Error waiting for clients");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < n; i++) {
+            int slot = events[i].data.u32;
+            if (slot == MAX_CLIENTS + 2) {
+                uint64_t expirations;
+                if (read(linger_timer, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+                    perror("Parent: Error reading linger timer");
+                    exit(EXIT_FAILURE);
+                }
+                continue;  // The deadline is checked below
+            }
+            if (slot >= MAX_CLIENTS) {
+                accept_clients(listen_fds[slot - MAX_CLIENTS]);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush_client(slot);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                read_client(child_pids, slot);
+            }
+        }
+
+        collect_results(n == 0);  // Nothing from the clients, so wait on the workers
+
+        // Hand partial frames to idle workers. Done after collecting, so a
+        // pending request always leaves a frame outstanding or the linger
+        // timer armed to wake us.
+        dispatch_ready(child_pids);
+        if (frames_outstanding == 0) {
+            arm_linger_timer();
+        }
+        write_output(child_pids);
+
+        // Send what the replies produced, and finish closing clients that are done
+        int dirty = num_dirty;
+        num_dirty = 0;
+        for (int i = 0; i < dirty; i++) {
+            clients[dirty_clients[i]].dirty = 0;
+            flush_client(dirty_clients[i]);
+        }
+    }
+
+    // Answer everything already taken in before going away
+    finish_pending(child_pids);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].fd != -1) {
+            flush_client(i);
+            close_client(i);
+        }
+    }
+    for (int i = 0; i < num_listeners; i++) {
+        close(listen_fds[i]);
+    }
+    if (listen_path) {
+        unlink(listen_path);
+    }
+    close(server_epoll);
+    if (linger_timer != -1) {
+        close(linger_timer);
+    }
+    if (uses_pipes() && !uring_active) {
+        close(epoll_fd);
+    }
+}
+
+int open_listener(int domain, struct sockaddr *addr, socklen_t len) {
+    int fd = socket(domain, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    int one = 1;
+    if (fd == -1 || (domain == AF_INET && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1) ||
+        bind(fd, addr, len) == -1 || listen(fd, SOMAXCONN) == -1) {
+        perror("Parent: Error opening listening socket");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+void accept_clients(int fd) {
+    while (1) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                perror("Parent: Error accepting client");
+            }
+            return;
+        }
+        if (fcntl(conn, F_SETFL, O_NONBLOCK) == -1) {
+            perror("Parent: Error setting up client");
+            close(conn);
+            continue;
+        }
+
+        int slot = 0;
+        while (slot < MAX_CLIENTS && clients[slot].fd != -1) {
+            slot++;
+        }
+        if (slot == MAX_CLIENTS) {
+            fprintf(stderr, "Parent: Too many clients, refusing a connection\n");
+            close(conn);
+            continue;
+        }
+
+        // Replies are small and latency matters more than packet count
+        int one = 1;
+        setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct client *client = &clients[slot];
+        client->fd = conn;
+        client->eof = 0;
+        client->pending = 0;
+        client->rx_used = 0;
+        client->tx_used = 0;
+        client->tx_sent = 0;
+        struct epoll_event event = {.events = EPOLLIN, .data.u32 = slot};
+        if (epoll_ctl(server_epoll, EPOLL_CTL_ADD, conn, &event) == -1) {
+            perror("Parent: Error watching client");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void read_client(pid_t child_pids[], int slot) {
+    struct client *client = &clients[slot];
+    if (client->fd == -1 || client->eof) {
+        return;
+    }
+
+    // One buffer per wakeup, so a busy client cannot starve the others
+    ssize_t n = read(client->fd, client->rx + client->rx_used, CLIENT_BUFFER - client->rx_used);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (n <= 0) {
+        // A client may shut down its side and still wait for the replies
+        if (n == -1) {
+            close_client(slot);
+            return;
+        }
+        client->eof = 1;
+        watch_client(slot);
+        if (!client->dirty) {
+            client->dirty = 1;
+            dirty_clients[num_dirty++] = slot;
+        }
+        return;
+    }
+    client->rx_used += n;
+
+    size_t whole = client->rx_used - client->rx_used % sizeof(struct wire_request);
+    for (size_t offset = 0; offset < whole; offset += sizeof(struct wire_request)) {
+        struct wire_request request;
+        memcpy(&request, client->rx + offset, sizeof(request));
+        queue_wire_request(child_pids, slot, &request);
+    }
+    client->rx_used -= whole;
+    memmove(client->rx, client->rx + whole, client->rx_used);
+}
+
+void queue_wire_request(pid_t child_pids[], int slot, const struct wire_request *request) {
+    make_room(child_pids, 0);
+
+    struct line_entry *entry = &window[next_line % WINDOW_LINES];
+    int op = code_ops[request->op] - 1;
+    entry->first_node = next_node;
+    entry->num_nodes = 0;
+    entry->client = slot;
+    entry->generation = clients[slot].generation;
+    entry->id = request->id;
+    entry->nums[0] = request->nums[0];
+    entry->nums[1] = request->nums[1];
+    clients[slot].pending++;
+    if (op < 0) {
+        entry->kind = LINE_BAD_OP;
+        entry->done = 1;
+    } else if (request->nums[1] == 0 && (op == OP_DIV || op == OP_MOD)) {
+        entry->kind = LINE_BAD_INPUT;  // The only bad input a binary request can carry
+        entry->done = 1;
+    } else {
+        entry->kind = LINE_RESULT;
+        entry->index = op;
+        queue_pair(child_pids, entry);
+    }
+    next_line++;
+}
+
+void server_reply(pid_t child_pids[], struct line_entry *entry) {
+    struct client *client = &clients[entry->client];
+    if (client->fd == -1 || client->generation != entry->generation) {
+        return;  // Connection went away meanwhile
+    }
+
+    struct wire_reply reply = {.id = entry->id};
+    reply.status = entry->kind == LINE_RESULT ? WIRE_OK : entry->kind == LINE_BAD_OP ? WIRE_BAD_OP : WIRE_DIV_ZERO;
+    reply.result = entry->kind == LINE_RESULT ? entry->result : 0;
+    reply.pid = entry->kind == LINE_RESULT && entry->index >= 0 ? child_pids[entry->index] : 0;
+
+    if (client->tx_used + sizeof(reply) > client->tx_size) {
+        client->tx_size = client->tx_size ? 2 * client->tx_size : CLIENT_BUFFER;
+        client->tx = realloc(client->tx, client->tx_size);
+        if (!client->tx) {
+            perror("Parent: Error growing reply buffer");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(client->tx + client->tx_used, &reply, sizeof(reply));
+    client->tx_used += sizeof(reply);
+    client->pending--;
+    if (!client->dirty) {
+        client->dirty = 1;
+        dirty_clients[num_dirty++] = entry->client;
+    }
+}
+
+void flush_client(int slot) {
+    struct client *client = &clients[slot];
+    if (client->fd == -1) {
+        return;
+    }
+
+    while (client->tx_sent < client->tx_used) {
+        ssize_t n = send(client->fd, client->tx + client->tx_sent, client->tx_used - client->tx_sent, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n == -1) {
+            close_client(slot);  // Gone without reading its replies
+            return;
+        }
+        client->tx_sent += n;
+    }
+    if (client->tx_sent == client->tx_used) {
+        client->tx_sent = client->tx_used = 0;
+    }
+    if (client->eof && client->pending == 0 && client->tx_used == 0) {
+        close_client(slot);
+        return;
+    }
+    watch_client(slot);
+}
+
+void watch_client(int slot) {
+    struct client *client = &clients[slot];
+
+    // Stop taking requests from a client that leaves its replies unread
+    int reading = !client->eof && client->tx_used - client->tx_sent < CLIENT_BACKLOG;
+    int writing = client->tx_sent < client->tx_used;
+    struct epoll_event event = {.events = (reading ? EPOLLIN : 0) | (writing ? EPOLLOUT : 0), .data.u32 = slot};
+    if (epoll_ctl(server_epoll, EPOLL_CTL_MOD, client->fd, &event) == -1) {
+        perror("Parent: Error watching client");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void close_client(int slot) {
+    struct client *client = &clients[slot];
+    close(client->fd);  // Also drops it from server_epoll
+    client->fd = -1;
+    client->generation++;
+}
+
+void handle_stop_signal(int signum) {
+    (void)signum;
+    server_stopping = 1;
+}
+
+void setup_cache(int capacity) {
+    // Round up to a power of two, with at least one full probe window
+    unsigned size = CACHE_PROBE;
+    while (size < (unsigned)capacity && size < 1u << 30) {
+        size <<= 1;
+    }
+    cache = aligned_alloc(CACHE_LINE, size * sizeof(struct cache_entry));
+    if (!cache) {
+        perror("Error allocating result cache");
+        exit(EXIT_FAILURE);
+    }
+    memset(cache, 0xff, size * sizeof(struct cache_entry));  // op -1 marks every slot empty
+    cache_mask = size - 1;
+}
+
+int cache_lookup(int op, int a, int b, int *result, int *worker) {
+    if (!cache) {
+        return 0;
+    }
+
+    // Open addressing: the key may sit anywhere in the CACHE_PROBE slots after its hash
+    uint64_t key = (uint64_t)(uint32_t)a << 32 | (uint32_t)b;
+    unsigned home = (unsigned)(((key ^ (uint64_t)op << 61) * 0x9E3779B97F4A7C15ULL) >> 32);
+    for (unsigned i = 0; i < CACHE_PROBE; i++) {
+        struct cache_entry *slot = &cache[(home + i) & cache_mask];
+        if (slot->op == op && slot->nums[0] == a && slot->nums[1] == b) {
+            slot->referenced = 1;
+            *result = slot->result;
+            *worker = slot->worker;
+            cache_hits++;
+            return 1;
+        }
+        if (slot->op == -1) {
+            break;  // Nothing is ever stored past an empty slot of the window
+        }
+    }
+    cache_misses++;
+    return 0;
+}
+
+void cache_insert(int op, int a, int b, int result, int worker) {
+    static unsigned clock_hand;
+    static uint32_t random_state = 2463534242u;
+
+    if (!cache) {
+        return;
+    }
+
+    uint64_t key = (uint64_t)(uint32_t)a << 32 | (uint32_t)b;
+    unsigned home = (unsigned)(((key ^ (uint64_t)op << 61) * 0x9E3779B97F4A7C15ULL) >> 32);
+    struct cache_entry *victim = NULL;
+    for (unsigned i = 0; i < CACHE_PROBE && !victim; i++) {
+        struct cache_entry *slot = &cache[(home + i) & cache_mask];
+        if (slot->op == -1 || (slot->op == op && slot->nums[0] == a && slot->nums[1] == b)) {
+            victim = slot;
+        }
+    }
+
+    if (!victim && cache_evict == CACHE_EVICT_RANDOM) {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        victim = &cache[(home + random_state % CACHE_PROBE) & cache_mask];
+        cache_evictions++;
+    } else if (!victim) {
+        // Second chance: skip slots hit since the hand last passed, clearing their bit
+        for (unsigned i = 0; !victim; i++, clock_hand++) {
+            struct cache_entry *slot = &cache[(home + clock_hand % CACHE_PROBE) & cache_mask];
+            if (!slot->referenced || i >= CACHE_PROBE) {
+                victim = slot;
+            }
+            slot->referenced = 0;
+        }
+        cache_evictions++;
+    }
+
+    victim->nums[0] = a;
+    victim->nums[1] = b;
+    victim->result = result;
+    victim->op = op;
+    victim->referenced = 0;
+    victim->worker = worker;
+}
+
+void make_room(pid_t child_pids[], size_t nodes_needed) {
+    // Room in the reorder window, and in the node ring for a line's worst case
+    // of one node per character. Both are freed as lines are written out.
+    for (int waited = 0;; waited = 1) {
+        unsigned oldest = next_output != next_line ? window[next_output % WINDOW_LINES].first_node : next_node;
+        if (next_line - next_output < WINDOW_LINES && next_node - oldest + nodes_needed <= EXPR_NODES) {
+            return;
+        }
+        if (waited) {
+            dispatch_all(child_pids);
+            collect_results(1);
+        }
+        schedule_nodes(child_pids);
+        write_output(child_pids);
+    }
+}
+
+int queue_expression(pid_t child_pids[], struct line_entry *entry, const char *line, size_t len) {
+    struct expr_parser ps = {.line = line, .p = line, .end = line + len};
+
+    // Parse the whole line into a DAG first; nothing is sent until it is known to be valid
+    entry->rescan_queued = 0;
+    node_generation++;
+    entry->root = parse_binary(&ps, 0);
+    while (!ps.problem && ps.p < ps.end && (*ps.p == ' ' || *ps.p == '\t' || *ps.p == '\r' || *ps.p == '\n')) {
+        ps.p++;
+    }
+    if (!ps.problem && ps.p < ps.end && *ps.p == ')') {
+        parse_error(&ps, LINE_BAD_INPUT, "unbalanced ')'");
+    } else if (!ps.problem && ps.p < ps.end && ((*ps.p >= '0' && *ps.p <= '9') || *ps.p == '(')) {
+        parse_error(&ps, LINE_BAD_INPUT, "expected an operation");
+    } else if (!ps.problem && ps.p < ps.end) {
+        parse_error(&ps, LINE_BAD_OP, "unknown operation");
+    }
+    if (ps.problem) {
+        report_line(line, ps.at, ps.problem);
+        next_node = entry->first_node;
+        entry->num_nodes = 0;
+        return ps.kind;
+    }
+    entry->num_nodes = next_node - entry->first_node;
+    for (unsigned n = entry->first_node; n != next_node; n++) {
+        nodes[n % EXPR_NODES].line = next_line;
+    }
+
+    // Leaves are known, so every operation on two literals can start right away
+    request_rescan(next_line);
+    schedule_nodes(child_pids);
+    return LINE_RESULT;
+}
+
+void schedule_nodes(pid_t child_pids[]) {
+    // Queue every node whose operands are now known, and finish lines whose root is done
+    while (rescan_head != rescan_tail) {
+        unsigned line = rescan[rescan_head++ % WINDOW_LINES];
+        struct line_entry *entry = &window[line % WINDOW_LINES];
+        struct expr_node *root = &nodes[entry->root % EXPR_NODES];
+        entry->rescan_queued = 0;
+        if (root->state == NODE_DONE || root->state == NODE_UNDEFINED) {
+            // Written out only now, so no node of the line is still out at a worker
+            entry->kind = root->state == NODE_DONE ? LINE_RESULT : LINE_BAD_INPUT;
+            if (entry->kind == LINE_BAD_INPUT) {
+                fprintf(stderr, "line %u: division by zero\n", entry->number);
+            }
+            entry->index = root->worker;
+            entry->result = root->value;
+            entry->done = 1;
+            continue;
+        }
+        for (unsigned n = entry->first_node; n != entry->first_node + entry->num_nodes; n++) {
+            struct expr_node *node = &nodes[n % EXPR_NODES];
+            struct expr_node *a = &nodes[node->args[0] % EXPR_NODES];
+            struct expr_node *b = &nodes[node->args[1] % EXPR_NODES];
+            if (node->state != NODE_WAITING || a->state == NODE_WAITING || a->state == NODE_QUEUED ||
+                b->state == NODE_WAITING || b->state == NODE_QUEUED) {
+                continue;
+            }
+            if (a->state == NODE_UNDEFINED || b->state == NODE_UNDEFINED ||
+                (b->value == 0 && (node->op == OP_DIV || node->op == OP_MOD))) {
+                // Undefined, and so is everything built on it
+                node->state = NODE_UNDEFINED;
+                node->value = 0;
+                node->worker = -1;
+                request_rescan(line);
+            } else if (cache_lookup(node->op, a->value, b->value, &node->value, &node->worker)) {
+                node->state = NODE_DONE;
+                request_rescan(line);  // Its dependents may be ready now
+            } else {
+                node->state = NODE_QUEUED;
+                queue_request(child_pids, node->op, n, a->value, b->value);
+            }
+        }
+    }
+}
+
+void request_rescan(unsigned line) {
+    struct line_entry *entry = &window[line % WINDOW_LINES];
+    if (!entry->rescan_queued) {
+        entry->rescan_queued = 1;
+        rescan[rescan_tail++ % WINDOW_LINES] = line;
+    }
+}
+
+unsigned parse_binary(struct expr_parser *ps, int min_precedence) {
+    // binary := factor (op binary)*, by precedence climbing over the registry:
+    // the right operand takes only operations that bind tighter, or as tight
+    // when right-associative
+    unsigned left = parse_factor(ps);
+    while (!ps->problem) {
+        while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t')) {
+            ps->p++;
+        }
+        int op;
+        size_t len = match_operation(ps->p, ps->end, &op);
+        if (!len || operations[op].precedence < min_precedence) {
+            return left;
+        }
+        ps->p += len;
+        if (++ps->depth > EXPR_DEPTH) {
+            parse_error(ps, LINE_BAD_INPUT, "expression nested too deeply");
+            return 0;
+        }
+        unsigned right = parse_binary(ps, operations[op].precedence + !operations[op].right_assoc);
+        ps->depth--;
+        left = make_node(op, left, right, 0);
+    }
+    return left;
+}
+
+unsigned parse_factor(struct expr_parser *ps) {
+    // factor := integer | '(' binary ')' | '-' factor
+    while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t')) {
+        ps->p++;
+    }
+    const char *start = ps->p;
+    if (ps->p < ps->end && *ps->p == '(') {
+        if (++ps->depth > EXPR_DEPTH) {
+            parse_error(ps, LINE_BAD_INPUT, "parentheses nested too deeply");
+            return 0;
+        }
+        ps->p++;
+        unsigned inner = parse_binary(ps, 0);
+        while (!ps->problem && ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t')) {
+            ps->p++;
+        }
+        if (!ps->problem && (ps->p == ps->end || *ps->p != ')')) {
+            parse_error(ps, LINE_BAD_INPUT, "expected ')'");
+        }
+        ps->p++;
+        ps->depth--;
+        return inner;
+    }
+    if (ps->p + 1 < ps->end && *ps->p == '-' && (ps->p[1] == '(' || ps->p[1] == '-')) {
+        // Negation is subtraction from zero
+        ps->p++;
+        if (++ps->depth > EXPR_DEPTH) {
+            parse_error(ps, LINE_BAD_INPUT, "parentheses nested too deeply");
+            return 0;
+        }
+        unsigned operand = parse_factor(ps);
+        ps->depth--;
+        return make_node(OP_SUB, make_node(-1, 0, 0, 0), operand, 0);
+    }
+
+    int value;
+    const char *problem = parse_int(&ps->p, ps->end, &value);
+    if (problem) {
+        ps->p = start;
+        parse_error(ps, LINE_BAD_INPUT, problem);
+        return 0;
+    }
+    return make_node(-1, 0, 0, value);
+}
+
+unsigned make_node(int op, unsigned a, unsigned b, int value) {
+    // Reuse an identical node of this line, so repeated subexpressions are computed once
+    uint64_t key = op < 0 ? (uint32_t)value : (uint64_t)a << 32 ^ b;
+    unsigned slot = (unsigned)((key * 0x9E3779B97F4A7C15ULL) >> 40) ^ (unsigned)(op + 1);
+    while (node_hash[slot % EXPR_NODES].generation == node_generation) {
+        unsigned n = node_hash[slot % EXPR_NODES].node;
+        struct expr_node *node = &nodes[n % EXPR_NODES];
+        if (node->op == op && (op < 0 ? node->value == value : node->args[0] == a && node->args[1] == b)) {
+            return n;
+        }
+        slot++;
+    }
+
+    unsigned n = next_node++;
+    struct expr_node *node = &nodes[n % EXPR_NODES];
+    node->op = op;
+    node->state = op < 0 ? NODE_DONE : NODE_WAITING;
+    node->args[0] = op < 0 ? n : a;  // A literal points at itself, which is already done
+    node->args[1] = op < 0 ? n : b;
+    node->value = value;
+    node->worker = -1;
+    node_hash[slot % EXPR_NODES].generation = node_generation;
+    node_hash[slot % EXPR_NODES].node = n;
+    return n;
+}
+
+void parse_error(struct expr_parser *ps, int kind, const char *problem) {
+    if (!ps->problem) {
+        ps->problem = problem;
+        ps->at = ps->p;
+        ps->kind = kind;
+    }
+}
+
+void dispatch_frame(pid_t child_pids[], int op) {
+    struct request_frame *frame = &open_frames[op];
+
+    if (frame->count == batch_limit) {
+        full_frames++;
+    } else if (frame->count != SLICE_FRAME) {
+        partial_frames++;
+    }
+    framed_pairs += frame->count != SLICE_FRAME ? frame->count : 0;
+
+    if (should_inline(op, frame->count)) {
+        inline_frame(op);
+        return;
+    }
+
+    // Backpressure: with no worker able to take the frame, nothing more is
+    // read from the input until one catches up
+    int index = pick_worker(op);
+    if (!window_open(index, frame->count)) {
+        window_waits++;
+        do {
+            collect_results(1);
+            index = pick_worker(op);
+        } while (!window_open(index, frame->count));
+    }
+
+    struct inflight_frame *slot = &inflight[frame->seq % FRAME_SLOTS];
+    slot->index = index;
+    slot->op = op;
+    slot->count = frame->count;
+    rtsig_seq[index] = frame->seq;
+    long long start = parent_cpu_ns();
+    send_frame(child_pids, index, frame);
+    slot->cost = cpu_since(start);
+    frames_in_flight[index]++;
+    frames_outstanding++;
+    owed_bytes[index] += result_bytes(frame->count);
+    frame->count = 0;
+}
+
+void inline_frame(int op) {
+    static struct result_frame done;
+    struct request_frame *frame = &open_frames[op];
+    struct inflight_frame *slot = &inflight[frame->seq % FRAME_SLOTS];
+
+    // Cheaper than a round trip: compute in the parent and complete it on the spot
+    long long start = parent_cpu_ns();
+    compute_batch(op, frame->a, frame->b, done.results, frame->count);
+    inline_pair_ns[op] += ((double)cpu_since(start) / frame->count - inline_pair_ns[op]) / 8;
+    inlined_frames++;
+
+    slot->index = -1;
+    slot->op = op;
+    slot->count = frame->count;
+    done.seq = frame->seq;
+    done.worker = -1;
+    done.count = frame->count;
+    frame->count = 0;
+    complete_frame(&done);
+}
+
+int should_inline(int op, int count) {
+    if (count == SLICE_FRAME || offload_policy == OFFLOAD_ALWAYS) {
+        return 0;
+    }
+    if (offload_policy == OFFLOAD_NEVER) {
+        return 1;
+    }
+    // Offload only when the parent would spend longer computing than shipping the frame
+    return inline_pair_ns[op] * count <= offload_frame_ns + offload_pair_ns * count;
+}
+
+void calibrate_offload(pid_t child_pids[]) {
+    static struct request_frame frame;
+    static struct result_frame done;
+    static int results[BATCH_MAX];
+
+    // The clock read is taken out of every timing, or it would be most of a single pair
+    long long first = parent_cpu_ns();
+    long long last = first;
+    for (int round = 0; round < 64; round++) {
+        last = parent_cpu_ns();
+    }
+    clock_read_ns = (last - first) / 64;
+
+    // Starting estimates, refined by every frame afterwards
+    for (int i = 0; i < BATCH_MAX; i++) {
+        frame.a[i] = i;
+        frame.b[i] = i + 1;
+    }
+    for (int op = 0; op < NUM_OPS; op++) {
+        long long start = parent_cpu_ns();
+        for (int round = 0; round < 8; round++) {
+            compute_batch(op, frame.a, frame.b, results, BATCH_MAX);
+        }
+        inline_pair_ns[op] = (double)cpu_since(start) / (8 * BATCH_MAX);
+    }
+
+    // Offloading a single pair and a full frame gives the fixed and per-pair cost
+    long long small = -1;
+    long long large = -1;
+    for (int round = 0; round < 8; round++) {
+        int index = pick_worker(round % NUM_OPS);
+        frame.seq = 0;
+        frame.count = 1;
+        long long ns = time_offload(child_pids, index, &frame, &done);
+        small = small == -1 || ns < small ? ns : small;
+        frame.count = BATCH_MAX;
+        ns = time_offload(child_pids, index, &frame, &done);
+        large = large == -1 || ns < large ? ns : large;
+    }
+    offload_pair_ns = large > small ? (double)(large - small) / (BATCH_MAX - 1) : 0;
+    offload_frame_ns = small - offload_pair_ns;
+}
+
+long long time_offload(pid_t child_pids[], int index, struct request_frame *frame, struct result_frame *done) {
+    // The parent's share of a round trip, the same send and receive time
+    // complete_frame() sees for every frame of the pipeline
+    long long start = parent_cpu_ns();
+    done->seq = frame->seq;
+    done->worker = index;
+    done->count = frame->count;
+    send_frame(child_pids, index, frame);
+    long long cost = cpu_since(start);
+
+    await_results(index, frame->count);
+    start = parent_cpu_ns();
+    receive_results(index, done);
+    return cost + cpu_since(start);
+}
+
+void await_results(int index, int count) {
+    // Until the whole frame can be taken, so none of the wait is timed as receiving
+    if (transport == TRANSPORT_THREAD) {
+        while (!queue_ready(&completions)) {
+            queue_wait(&completions);
+        }
+    } else if (transport == TRANSPORT_SHM) {
+        struct shm_ring *ring = &channels[index].results;
+        int spins = 0;
+        while (atomic_load_explicit(&ring->tail, memory_order_acquire) -
+                   atomic_load_explicit(&ring->head, memory_order_relaxed) <
+               (unsigned)(3 + frame_pairs(count))) {
+            spin_wait(&spins);
+        }
+    } else {
+        struct pollfd readable = {.fd = pipes_to_parent[index][0], .events = POLLIN};
+        while (poll(&readable, 1, -1) == -1) {
+            if (errno != EINTR) {
+                perror("Parent: Error waiting for results");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+void dispatch_all(pid_t child_pids[]) {
+    for (int op = 0; op < NUM_OPS; op++) {
+        if (open_frames[op].count > 0) {
+            dispatch_frame(child_pids, op);
+        }
+    }
+}
+
+void dispatch_ready(pid_t child_pids[]) {
+    // A partial frame goes to an idle worker once it has waited out the
+    // deadline; until then more requests may join it
+    long long now = linger_ns > 0 ? now_ns() : 0;
+    for (int op = 0; op < NUM_OPS; op++) {
+        if (open_frames[op].count > 0 && frames_in_flight[pick_worker(op)] == 0 &&
+            now - frame_opened[op] >= linger_ns) {
+            dispatch_frame(child_pids, op);
+        }
+    }
+}
+
+void arm_linger_timer(void) {
+    long long deadline = -1;
+    for (int op = 0; op < NUM_OPS; op++) {
+        if (open_frames[op].count > 0 && (deadline == -1 || frame_opened[op] + linger_ns < deadline)) {
+            deadline = frame_opened[op] + linger_ns;
+        }
+    }
+    if (linger_timer == -1 || deadline == -1) {
+        return;
+    }
+
+    // Relative to now; a deadline already past still needs a nonzero value to arm
+    long long wait = deadline - now_ns();
+    wait = wait > 0 ? wait : 1;
+    struct itimerspec timer = {.it_value = {.tv_sec = wait / 1000000000, .tv_nsec = wait % 1000000000}};
+    if (timerfd_settime(linger_timer, 0, &timer, NULL) == -1) {
+        perror("Parent: Error arming linger timer");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void collect_results(int block) {
+    static struct result_frame done;
+    int ready[MAX_WORKERS];
+    int num_ready = 0;
+
+    if (frames_outstanding == 0) {
+        block = 0;  // Frames computed inline leave nothing to wait for
+    }
+
+    if (uring_active) {
+        // One io_uring_enter() submits the queued writes and reaps every completion
+        uring_enter(block ? 1 : 0);
+        uring_reap();
+        return;
+    }
+
+    if (transport == TRANSPORT_THREAD) {
+        // Every thread reports on the one completion queue
+        if (!block && !queue_ready(&completions)) {
+            return;
+        }
+        do {
+            if (stats_requested) {
+                dump_stats();
+            }
+            // Waiting is not the parent's work, taking the results is
+            while (!queue_ready(&completions)) {
+                queue_wait(&completions);
+            }
+            long long start = parent_cpu_ns();
+            receive_results(-1, &done);
+            inflight[done.seq % FRAME_SLOTS].cost += cpu_since(start);
+            complete_frame(&done);
+        } while (queue_ready(&completions));
+        return;
+    }
+
+    if (transport == TRANSPORT_SHM) {
+        // Result rings cannot be polled by the kernel, so look at them directly
+        int spins = 0;
+        while (1) {
+            if (stats_requested) {
+                dump_stats();
+            }
+            for (int i = 0; i < num_workers; i++) {
+                struct shm_ring *ring = &channels[i].results;
+                if (atomic_load_explicit(&ring->tail, memory_order_acquire) !=
+                    atomic_load_explicit(&ring->head, memory_order_relaxed)) {
+                    ready[num_ready++] = i;
+                }
+            }
+            if (num_ready > 0 || !block) {
+                break;
+            }
+            spin_wait(&spins);
+        }
+    } else {
+        struct epoll_event events[2 * MAX_WORKERS];
+        int n;
+        do {
+            if (stats_requested) {
+                dump_stats();
+            }
+            n = epoll_wait(epoll_fd, events, 2 * MAX_WORKERS, block ? -1 : 0);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1) {
+            perror("Parent: Error waiting for results");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u32 >= MAX_WORKERS) {
+                flush_outbox(events[i].data.u32 - MAX_WORKERS);  // Room in a request pipe
+            } else {
+                ready[num_ready++] = events[i].data.u32;
+            }
+        }
+    }
+
+    for (int i = 0; i < num_ready; i++) {
+        int index = ready[i];
+        if (transport == TRANSPORT_RTSIG) {
+            done.seq = rtsig_seq[index];
+            done.worker = index;
+            done.count = inflight[done.seq % FRAME_SLOTS].count;
+        }
+        long long start = parent_cpu_ns();
+        receive_results(index, &done);
+        inflight[done.seq % FRAME_SLOTS].cost += cpu_since(start);
+        complete_frame(&done);
+    }
+}
+
+void complete_frame(struct result_frame *done) {
+    struct inflight_frame *frame = &inflight[done->seq % FRAME_SLOTS];
+
+    frame->busy = 0;  // Nothing below opens a frame, so the slot stays intact until we return
+    if (frame->count == SLICE_FRAME) {
+        bulk_computed += done->results[0];
+        frames_in_flight[frame->index]--;
+        frames_outstanding--;
+        owed_bytes[frame->index] -= result_bytes(frame->count);
+        return;
+    }
+    if (done->count != frame->count) {
+        fprintf(stderr, "Parent: Frame %d returned %d results, expected %d\n", done->seq, done->count,
+                frame->count);
+        exit(EXIT_FAILURE);
+    }
+    if (frame->index >= 0) {
+        // Send plus receive time, as calibrated: keep the per-pair slope, track the fixed cost as it drifts
+        offload_frame_ns += (frame->cost - offload_pair_ns * frame->count - offload_frame_ns) / 8;
+        offloaded_frames++;
+        frames_in_flight[frame->index]--;
+        frames_outstanding--;
+        owed_bytes[frame->index] -= result_bytes(frame->count);
+    }
+    if (expression_mode) {
+        // Finished nodes may unblock others; they are scheduled outside the completion path
+        for (int i = 0; i < frame->count; i++) {
+            struct expr_node *node = &nodes[frame->lines[i] % EXPR_NODES];
+            node->value = done->results[i];
+            node->worker = done->worker;
+            node->state = NODE_DONE;
+            request_rescan(node->line);
+            cache_insert(node->op, nodes[node->args[0] % EXPR_NODES].value, nodes[node->args[1] % EXPR_NODES].value,
+                         node->value, node->worker);
+        }
+        return;
+    }
+
+    // Place each result at its input line
+    for (int i = 0; i < frame->count; i++) {
+        struct line_entry *entry = &window[frame->lines[i] % WINDOW_LINES];
+        cache_insert(frame->op, entry->nums[0], entry->nums[1], done->results[i], done->worker);
+        entry->index = done->worker;
+        entry->result = done->results[i];
+        entry->done = 1;
+    }
+}
+
+void finish_pending(pid_t child_pids[]) {
+    // Wait for everything still in flight and flush it out
+    schedule_nodes(child_pids);
+    write_output(child_pids);
+    while (next_output != next_line) {
+        dispatch_all(child_pids);
+        collect_results(1);
+        schedule_nodes(child_pids);
+        write_output(child_pids);
+    }
+    flush_output();
+}
+
+void write_output(pid_t child_pids[]) {
+    const char *bad_input = compact_output ? "E invalid input\n" : "Invalid input. Please try again.\n";
+    const char *bad_op = compact_output ? "E invalid operation\n" : bad_op_text;
+    (void)child_pids;  // Already baked into pid_lines
+
+    // Format the results in input order; they reach stdout on the next flush_output()
+    while (next_output != next_line && window[next_output % WINDOW_LINES].done) {
+        struct line_entry *entry = &window[next_output % WINDOW_LINES];
+        if (listen_path || listen_port) {
+            server_reply(child_pids, entry);  // Goes back to the client that asked
+            next_output++;
+            continue;
+        }
+        char *p = output_space();
+        if (entry->kind == LINE_BAD_INPUT) {
+            p = stpcpy(p, bad_input);
+        } else if (entry->kind == LINE_BAD_OP) {
+            p = stpcpy(p, bad_op);
+        } else {
+            if (!compact_output && entry->index >= 0) {
+                memcpy(p, pid_lines[entry->index], pid_line_len[entry->index]);
+                p += pid_line_len[entry->index];
+            } else if (!compact_output) {
+                p = stpcpy(p, "Result: ");  // Nothing to compute, so no child to name
+            }
+            p += format_int(p, entry->result);
+            *p++ = '\n';
+            if (!compact_output) {
+                *p++ = '\n';
+            }
+        }
+        output_used[output_block] = p - output[output_block];
+        next_output++;
+    }
+}
+
+void prepare_output(pid_t child_pids[]) {
+    // The PID line only depends on the worker, so format it once
+    for (int i = 0; i < num_workers; i++) {
+        pid_line_len[i] = snprintf(pid_lines[i], OUTPUT_RECORD,
+                                   "The child process with PID: %d will provide the result.\nResult: ", child_pids[i]);
+    }
+}
+
+char *output_space(void) {
+    // Room for one more record, moving to the next block or flushing when full
+    if (OUTPUT_BLOCK - output_used[output_block] < OUTPUT_RECORD) {
+        if (++output_block == OUTPUT_BLOCKS) {
+            flush_output();
+        }
+    }
+    return output[output_block] + output_used[output_block];
+}
+
+void flush_output(void) {
+    static struct iovec iov[OUTPUT_BLOCKS];
+    int count = 0;
+
+    for (int i = 0; i < OUTPUT_BLOCKS && i <= output_block; i++) {
+        if (output_used[i] > 0) {
+            iov[count].iov_base = output[i];
+            iov[count].iov_len = output_used[i];
+            count++;
+        }
+        output_used[i] = 0;
+    }
+    output_block = 0;
+
+    // One system call for all blocks, picking up after any short write
+    struct iovec *next = iov;
+    while (count > 0 && uring_active) {
+        // Goes out with whatever frames are queued; the blocks are reused once it completes
+        struct io_uring_sqe *sqe = uring_sqe(URING_OUTPUT, 0);
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = STDOUT_FILENO;
+        sqe->addr = (uintptr_t)next;
+        sqe->len = count;
+        sqe->off = -1;
+        output_pending = -1;
+        while (output_pending == -1) {
+            uring_enter(1);
+            uring_reap();
+        }
+        size_t n = output_pending;
+        while (count > 0 && n >= next->iov_len) {
+            n -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0) {
+            next->iov_base = (char *)next->iov_base + n;
+            next->iov_len -= n;
+        }
+    }
+    while (count > 0) {
+        ssize_t n = writev(STDOUT_FILENO, next, count);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            perror("Parent: Error writing output");
+            exit(EXIT_FAILURE);
+        }
+        while (count > 0 && (size_t)n >= next->iov_len) {
+            n -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0) {
+            next->iov_base = (char *)next->iov_base + n;
+            next->iov_len -= n;
+        }
+    }
+}
+
+size_t format_int(char *out, int value) {
+    char digits[12];
+    char *p = digits + sizeof(digits);
+    uint32_t v = value < 0 ? 0 - (uint32_t)value : (uint32_t)value;
+
+    // Two digits per division, from a table of "00" to "99"
+    while (v >= 100) {
+        unsigned pair = v % 100 * 2;
+        v /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (v >= 10) {
+        *--p = digit_pairs[v * 2 + 1];
+        *--p = digit_pairs[v * 2];
+    } else {
+        *--p = '0' + v;
+    }
+    if (value < 0) {
+        *--p = '-';
+    }
+
+    size_t len = digits + sizeof(digits) - p;
+    memcpy(out, p, len);
+    return len;
+}
+
+void latency_probe(pid_t child_pids[]) {
+    static struct request_frame frame;
+    long long total = 0;
+    long long best = -1;
+
+    // Time single-request round trips, rotating through the children
+    frame.seq = 0;
+    frame.count = 1;
+    for (int i = 0; i < probe_count; i++) {
+        struct timespec start, end;
+        int index = pick_worker(i % NUM_OPS);
+        struct result_frame done = {.seq = 0, .worker = index, .count = 1};
+
+        frame.a[0] = i;
+        frame.b[0] = 2;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        send_frame(child_pids, index, &frame);
+        receive_results(index, &done);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        long long ns = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+        total += ns;
+        if (best == -1 || ns < best) {
+            best = ns;
+        }
+    }
+
+    printf("Round trips: %d, min %lld ns, avg %lld ns\n", probe_count, best, total / probe_count);
+}
+
+int window_open(int index, int count) {
+    // A frame may go out while the results its child owes still fit in the
+    // pipe back, so the child never blocks writing them while we wait on it
+    if (frames_in_flight[index] == 0) {
+        return 1;
+    }
+    if (transport == TRANSPORT_RTSIG) {
+        return 0;  // Results come back bare, one frame at a time
+    }
+    if (uring_active) {
+        return frames_in_flight[index] < PIPELINE_DEPTH;
+    }
+    return owed_bytes[index] + result_bytes(count) <= result_credit[index] && frames_outstanding < FRAME_SLOTS / 2;
+}
+
+int claim_seq(pid_t child_pids[], int op) {
+    // Sequence IDs index inflight[], so a frame that is still open or in flight
+    // 256 IDs later has to go out or come back before its slot is reused
+    struct inflight_frame *slot = &inflight[next_frame_seq % FRAME_SLOTS];
+    while (slot->busy) {
+        window_waits++;
+        if (open_frames[slot->op].count != 0 && open_frames[slot->op].seq % FRAME_SLOTS == next_frame_seq % FRAME_SLOTS) {
+            dispatch_frame(child_pids, slot->op);
+        } else {
+            collect_results(1);
+        }
+    }
+    slot->busy = 1;
+    slot->op = op;
+    return next_frame_seq++;
+}
+
+int result_bytes(int count) {
+    return (3 + frame_pairs(count)) * sizeof(int);
+}
+
+int pick_worker(int op) {
+    // Prefer the least loaded worker, rotating among equally loaded ones
+    int best = -1;
+    for (int i = 0; i < pool_size[op]; i++) {
+        int w = first_worker[op] + (next_in_pool[op] + i) % pool_size[op];
+        if (best == -1 || owed_bytes[w] < owed_bytes[best]) {
+            best = w;
+        }
+    }
+    next_in_pool[op] = (best - first_worker[op] + 1) % pool_size[op];
+    return best;
+}
+
+void parse_workers(char *spec) {
+    int total = 0;
+
+    // Spec looks like "add=1,div=2,mul=8"; operations left out keep one worker
+    for (char *item = strtok(spec, ","); item; item = strtok(NULL, ",")) {
+        char *eq = strchr(item, '=');
+        int op = 0;
+        while (op < NUM_OPS && (!eq || strncmp(item, operations[op].name, eq - item) != 0 ||
+                                strlen(operations[op].name) != (size_t)(eq - item))) {
+            op++;
+        }
+        if (op == NUM_OPS || atoi(eq + 1) < 1) {
+            fprintf(stderr, "Invalid worker spec '%s', expected name=N with one of", item);
+            for (op = 0; op < NUM_OPS; op++) {
+                fprintf(stderr, " %s", operations[op].name);
+            }
+            fprintf(stderr, "\n");
+            exit(EXIT_FAILURE);
+        }
+        pool_size[op] = atoi(eq + 1);
+    }
+
+    for (int op = 0; op < NUM_OPS; op++) {
+        total += pool_size[op];
+    }
+    if (total > MAX_WORKERS) {
+        fprintf(stderr, "Too many workers (%d), the limit is %d\n", total, MAX_WORKERS);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void parse_affinity(char *spec) {
+    const char *presets[] = {"none", "pair", "spread", "isolate"};
+
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(spec, presets[i]) == 0) {
+            affinity = i;  // In the order of the AFFINITY_ presets
+            return;
+        }
+    }
+
+    // Otherwise "parent=0,add=2,mul=4": a pool of N workers takes CPUs 2..2+N-1,
+    // and whatever is left out stays wherever the kernel puts it
+    affinity = AFFINITY_LIST;
+    for (int i = 0; i <= NUM_OPS; i++) {
+        affinity_first[i] = -1;
+    }
+    for (char *item = strtok(spec, ","); item; item = strtok(NULL, ",")) {
+        char *eq = strchr(item, '=');
+        int who = 0;
+        while (who <= NUM_OPS && eq) {
+            const char *name = who == NUM_OPS ? "parent" : operations[who].name;
+            if (strncmp(item, name, eq - item) == 0 && strlen(name) == (size_t)(eq - item)) {
+                break;
+            }
+            who++;
+        }
+        if (!eq || who > NUM_OPS || eq[1] < '0' || eq[1] > '9' || atoi(eq + 1) >= MAX_CPUS) {
+            fprintf(stderr, "Invalid affinity '%s', expected none, pair, spread, isolate or name=cpu with parent or one of", item);
+            for (int op = 0; op < NUM_OPS; op++) {
+                fprintf(stderr, " %s", operations[op].name);
+            }
+            fprintf(stderr, "\n");
+            exit(EXIT_FAILURE);
+        }
+        affinity_first[who] = atoi(eq + 1);
+    }
+}
+
+void plan_affinity(void) {
+    cpu_set_t allowed;
+    int cpus[MAX_CPUS];
+    int n = 0;
+
+    if (affinity == AFFINITY_NONE) {
+        return;
+    }
+    // Presets only choose among the CPUs we were started on
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        perror("Error reading CPU affinity");
+        exit(EXIT_FAILURE);
+    }
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus[n++] = cpu;
+        }
+    }
+
+    if (affinity == AFFINITY_LIST) {
+        for (int who = 0; who <= NUM_OPS; who++) {
+            int count = who == NUM_OPS ? 1 : pool_size[who];
+            for (int k = 0; k < count && affinity_first[who] >= 0; k++) {
+                int cpu = affinity_first[who] + k;
+                if (cpu >= MAX_CPUS || !CPU_ISSET(cpu, &allowed)) {
+                    fprintf(stderr, "CPU %d is not available for %s\n", cpu,
+                            who == NUM_OPS ? "parent" : operations[who].name);
+                    exit(EXIT_FAILURE);
+                }
+                CPU_SET(cpu, who == NUM_OPS ? &parent_cpus : &worker_cpus[first_worker[who] + k]);
+            }
+        }
+        return;
+    }
+    if (n < 2) {
+        fprintf(stderr, "--affinity needs a second CPU, leaving placement to the kernel\n");
+        affinity = AFFINITY_NONE;
+        return;
+    }
+
+    int parent = cpus[0];
+    CPU_SET(parent, &parent_cpus);
+    if (affinity == AFFINITY_PAIR) {
+        // Every worker on the parent's sibling hyperthread, so a round trip
+        // never leaves the core's caches; the next CPU when there is none
+        int sibling = cpus[1];
+        for (int i = 1; i < n; i++) {
+            if (core_of(cpus[i]) == core_of(parent)) {
+                sibling = cpus[i];
+                break;
+            }
+        }
+        for (int i = 0; i < num_workers; i++) {
+            CPU_SET(sibling, &worker_cpus[i]);
+        }
+    } else if (affinity == AFFINITY_SPREAD) {
+        // Round-robin over one CPU per core first, the siblings after them
+        int order[MAX_CPUS];
+        int m = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            for (int i = 1; i < n; i++) {
+                if ((core_of(cpus[i]) == cpus[i]) == (pass == 0)) {
+                    order[m++] = cpus[i];
+                }
+            }
+        }
+        for (int i = 0; i < num_workers; i++) {
+            CPU_SET(order[i % m], &worker_cpus[i]);
+        }
+    } else {
+        // The workers share every other core and leave the parent's alone,
+        // or every other CPU when the parent's core is all there is
+        cpu_set_t rest;
+        CPU_ZERO(&rest);
+        int shared = 0;
+        for (int pass = 0; pass < 2 && shared == 0; pass++) {
+            for (int i = 1; i < n; i++) {
+                if (pass == 1 || core_of(cpus[i]) != core_of(parent)) {
+                    CPU_SET(cpus[i], &rest);
+                    shared++;
+                }
+            }
+        }
+        for (int i = 0; i < num_workers; i++) {
+            worker_cpus[i] = rest;
+        }
+    }
+}
+
+int core_of(int cpu) {
+    // A core is named by its lowest CPU, the first in the sibling list
+    char path[96];
+    int first = cpu;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    FILE *file = fopen(path, "r");
+    if (file) {
+        if (fscanf(file, "%d", &first) != 1) {
+            first = cpu;
+        }
+        fclose(file);
+    }
+    return first;
+}
+
+void pin_cpus(const cpu_set_t *mask) {
+    // The calling thread only, so each worker thread pins itself
+    if (CPU_COUNT(mask) == 0) {
+        return;
+    }
+    if (sched_setaffinity(0, sizeof(*mask), mask) == -1) {
+        perror("Error setting CPU affinity");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int parse_request(const char *input, size_t len, int nums[2], int *index) {
+    const char *end = input + len;
+    const char *p = input;
+
+    // "<int> <int> <op>", whitespace around each field, anything after the operation is ignored
+    for (int i = 0; i < 2; i++) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            p++;
+        }
+        const char *field = p;
+        const char *problem = parse_int(&p, end, &nums[i]);
+        if (problem) {
+            report_line(input, field, problem);
+            return LINE_BAD_INPUT;
+        }
+    }
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    if (p == end || *p == '\n') {
+        report_line(input, p, "expected an operation");
+        return LINE_BAD_INPUT;
+    }
+
+    // The operation picks the worker pool
+    if (!match_operation(p, end, index)) {
+        report_line(input, p, "unknown operation");
+        return LINE_BAD_OP;
+    }
+    if (nums[1] == 0 && (*index == OP_DIV || *index == OP_MOD)) {
+        report_line(input, p, "division by zero");
+        return LINE_BAD_INPUT;
+    }
+    return LINE_RESULT;
+}
+
+const char *parse_int(const char **cursor, const char *end, int *value) {
+    const char *p = *cursor;
+    int negative = p < end && *p == '-';
+    uint64_t magnitude = 0;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    const char *digits = p;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // Eight digits at once: check and combine them in one 64-bit word
+    if (end - p >= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, p, 8);
+        if (((chunk & 0xF0F0F0F0F0F0F0F0ULL) | (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+            0x3333333333333333ULL) {
+            chunk -= 0x3030303030303030ULL;
+            chunk = chunk * 10 + (chunk >> 8);  // Pairs of digits
+            magnitude = ((chunk & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)) +
+                         ((chunk >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))) >> 32;
+            p += 8;
+        }
+    }
+#endif
+    while (p < end && *p >= '0' && *p <= '9') {
+        magnitude = magnitude * 10 + (*p++ - '0');
+        if (magnitude > 2147483648ULL) {
+            return "integer out of range";
+        }
+    }
+    if (p == digits) {
+        return "expected an integer";
+    }
+    if (magnitude > 2147483647ULL + negative) {
+        return "integer out of range";
+    }
+    *value = negative ? (int)(0 - (uint32_t)magnitude) : (int)magnitude;
+    *cursor = p;
+    return NULL;
+}
+
+void report_line(const char *line, const char *at, const char *problem) {
+    // The result stream keeps its usual message, the details go to stderr
+    if (at) {
+        fprintf(stderr, "line %u, column %d: %s\n", input_lines, (int)(at - line) + 1, problem);
+    } else {
+        fprintf(stderr, "line %u: %s\n", input_lines, problem);
+    }
+}
+
+int frame_pairs(int count) {
+    // Operand pairs carried by a frame, or 0 when the count is corrupt
+    if (count == SLICE_FRAME) {
+        return 1;
+    }
+    return count >= 1 && count <= BATCH_MAX ? count : 0;
+}
+
+size_t frame_iov(struct request_frame *frame, struct iovec parts[3]) {
+    // The frame as it goes on the wire: the header, then each column cut to the count
+    size_t column = frame_pairs(frame->count) * sizeof(int);
+    parts[0] = (struct iovec){&frame->seq, 2 * sizeof(int)};
+    parts[1] = (struct iovec){frame->a, column};
+    parts[2] = (struct iovec){frame->b, column};
+    return 2 * sizeof(int) + 2 * column;
+}
+
+void copy_frame(struct request_frame *to, const struct request_frame *from) {
+    to->seq = from->seq;
+    to->count = from->count;
+    memcpy(to->a, from->a, frame_pairs(from->count) * sizeof(int));
+    memcpy(to->b, from->b, frame_pairs(from->count) * sizeof(int));
+}
+
+void send_frame(pid_t child_pids[], int index, struct request_frame *frame) {
+    long long start = now_ns();
+
+    if (uring_active) {
+        // Queued behind any frame still being written to this child, submitted with the next enter
+        struct uring_child *child = &uring_children[index];
+        struct iovec parts[3];
+        char *wire = (char *)uring_frames[frame->seq % FRAME_SLOTS];
+        frame_iov(frame, parts);
+        for (int i = 0; i < 3; i++) {
+            memcpy(wire, parts[i].iov_base, parts[i].iov_len);
+            wire += parts[i].iov_len;
+        }
+        child->queue[child->queued++] = frame->seq;
+        if (!child->writing) {
+            uring_write_frame(index);
+        }
+        stat_add(STAGE_SEND, start);
+        return;
+    }
+
+    if (transport == TRANSPORT_THREAD) {
+        // Any thread of the pool may take it; index only does the accounting
+        copy_frame(&thread_requests[frame->seq % FRAME_SLOTS], frame);
+        queue_push(&request_queues[worker_op[index]], frame->seq);
+        stat_add(STAGE_SEND, start);
+        return;
+    }
+
+    if (transport == TRANSPORT_RTSIG) {
+        atomic_store_explicit(&stats[index].wake_stamp, start, memory_order_relaxed);
+        // Both operands ride in the signal payload, no pipe write and no separate wakeup
+        for (int i = 0; i < frame->count; i++) {
+            uint64_t packed = (uint64_t)(uint32_t)frame->a[i] << 32 | (uint32_t)frame->b[i];
+            union sigval value = {.sival_ptr = (void *)(uintptr_t)packed};
+            int spins = 0;
+            while (sigqueue(child_pids[index], SIGRTMIN + worker_op[index], value) == -1) {
+                if (errno != EAGAIN) {
+                    perror("Parent: Error queueing signal to child");
+                    exit(EXIT_FAILURE);
+                }
+                spin_wait(&spins);  // Signal queue is full, let the child catch up
+            }
+        }
+        stat_add(STAGE_SEND, start);
+        return;
+    }
+
+    struct iovec parts[3];
+    size_t len = frame_iov(frame, parts);
+    if (transport == TRANSPORT_SHM) {
+        // The child takes the frame only once all three parts are published
+        for (int i = 0; i < 3; i++) {
+            ring_push(&channels[index].requests, parts[i].iov_base, parts[i].iov_len / sizeof(int));
+        }
+    } else if (use_outboxes) {
+        post_request(index, parts, 3, len);
+    } else if (writev_full(pipes_to_child[index][1], parts, 3) == -1) {
+        // Send data to the appropriate child process
+        perror("Parent: Error writing numbers to child");
+        exit(EXIT_FAILURE);
+    }
+    stat_add(STAGE_SEND, start);
+
+    // Only wake a child that has announced it is going to sleep
+    if (channels) {
+        atomic_fetch_add(&channels[index].posted, 1);
+    }
+    if (!channels || atomic_exchange(&channels[index].waiting, 0)) {
+        wake_child(child_pids, index);
+    }
+}
+
+void post_request(int index, struct iovec *parts, int count, size_t len) {
+    struct outbox *box = &outboxes[index];
+    size_t skip = 0;
+
+    // Straight into the pipe as far as it has room, unless earlier bytes are still queued
+    if (box->head == box->used) {
+        ssize_t n;
+        do {
+            n = writev(pipes_to_child[index][1], parts, count);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1 && errno != EAGAIN) {
+            perror("Parent: Error writing numbers to child");
+            exit(EXIT_FAILURE);
+        }
+        if (n == (ssize_t)len) {
+            return;
+        }
+        skip = n > 0 ? n : 0;
+        box->head = box->used = 0;
+
+        // The child wakes on the part already written and blocks reading the rest
+        struct epoll_event event = {.events = EPOLLOUT, .data.u32 = MAX_WORKERS + index};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pipes_to_child[index][1], &event) == -1) {
+            perror("Parent: Error watching pipe to child");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Keep the unsent bytes at the front so the box only has to hold what is queued
+    if (box->head > 0) {
+        memmove(box->data, box->data + box->head, box->used - box->head);
+        box->used -= box->head;
+        box->head = 0;
+    }
+
+    // The window bounds the queued bytes, so this only waits when a request pipe is
+    // smaller than the result pipe; the child owes too little to stop reading it
+    while (box->used + len - skip > OUTBOX_BYTES) {
+        struct pollfd writable = {.fd = pipes_to_child[index][1], .events = POLLOUT};
+        if (poll(&writable, 1, -1) == -1 && errno != EINTR) {
+            perror("Parent: Error waiting on pipe to child");
+            exit(EXIT_FAILURE);
+        }
+        if (flush_outbox(index)) {
+            // Drained and unwatched, watch again for the bytes about to be queued
+            struct epoll_event event = {.events = EPOLLOUT, .data.u32 = MAX_WORKERS + index};
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pipes_to_child[index][1], &event) == -1) {
+                perror("Parent: Error watching pipe to child");
+                exit(EXIT_FAILURE);
+            }
+        }
+        memmove(box->data, box->data + box->head, box->used - box->head);
+        box->used -= box->head;
+        box->head = 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (skip >= parts[i].iov_len) {
+            skip -= parts[i].iov_len;
+            continue;
+        }
+        memcpy(box->data + box->used, (char *)parts[i].iov_base + skip, parts[i].iov_len - skip);
+        box->used += parts[i].iov_len - skip;
+        skip = 0;
+    }
+}
+
+int flush_outbox(int index) {
+    struct outbox *box = &outboxes[index];
+
+    while (box->head < box->used) {
+        ssize_t n = write(pipes_to_child[index][1], box->data + box->head, box->used - box->head);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && errno == EAGAIN) {
+            return 0;
+        }
+        if (n == -1) {
+            perror("Parent: Error writing numbers to child");
+            exit(EXIT_FAILURE);
+        }
+        box->head += n;
+    }
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, pipes_to_child[index][1], NULL) == -1) {
+        perror("Parent: Error unwatching pipe to child");
+        exit(EXIT_FAILURE);
+    }
+    return 1;
+}
+
+void wake_child(pid_t child_pids[], int index) {
+    long long start = now_ns();
+
+    atomic_store_explicit(&stats[index].wake_stamp, start, memory_order_relaxed);
+    if (wakeup == WAKE_SIGNAL) {
+        // Signal child to perform calculation
+        if (kill(child_pids[index], signals[worker_op[index]]) == -1) {
+            perror("Parent: Error sending signal to child");
+            exit(EXIT_FAILURE);
+        }
+    } else if (wakeup == WAKE_EVENTFD) {
+        uint64_t one = 1;
+        if (write(event_fds[index], &one, sizeof(one)) == -1) {
+            perror("Parent: Error writing eventfd");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        if (syscall(SYS_futex, &channels[index].waiting, FUTEX_WAKE, 1, NULL, NULL, 0) == -1) {
+            perror("Parent: Error waking futex");
+            exit(EXIT_FAILURE);
+        }
+    }
+    stat_add(STAGE_WAKE, start);
+}
+
+void receive_results(int index, struct result_frame *done) {
+    int fd = index >= 0 ? pipes_to_parent[index][0] : -1;
+    long long start = now_ns();
+
+    if (transport == TRANSPORT_THREAD) {
+        // The next finished frame from any thread; one is outstanding when a caller waits on a worker
+        struct result_frame *result = &thread_results[queue_wait_pop(&completions) % FRAME_SLOTS];
+        memcpy(&done->seq, &result->seq, 3 * sizeof(int));
+        memcpy(done->results, result->results, result->count * sizeof(result->results[0]));
+        stat_add(STAGE_RECEIVE, start);
+        return;
+    }
+
+    if (transport == TRANSPORT_SHM) {
+        ring_pop(&channels[index].results, &done->seq, 3);
+        ring_pop(&channels[index].results, done->results, done->count);
+        stat_add(STAGE_RECEIVE, start);
+        return;
+    }
+
+    // For TRANSPORT_RTSIG the results come back bare and the caller fills in seq and count
+    if ((transport != TRANSPORT_RTSIG && read_full(fd, &done->seq, 3 * sizeof(int)) == -1) ||
+        done->count < 1 || done->count > BATCH_MAX ||
+        read_full(fd, done->results, done->count * sizeof(done->results[0])) == -1) {
+        perror("Parent: Error reading result from child");
+        exit(EXIT_FAILURE);
+    }
+    stat_add(STAGE_RECEIVE, start);
+}
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long parent_cpu_ns(void) {
+    // What the offload policy weighs. CPU time, so a child that preempts us
+    // right after its wakeup does not bill its compute to the send; a system
+    // call, so it is only read when the policy needs it
+    if (offload_policy != OFFLOAD_AUTO) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+long long cpu_since(long long start) {
+    // Parent CPU time spent since start, less the read that ended it
+    long long ns = parent_cpu_ns() - start - clock_read_ns;
+    return ns > 0 ? ns : 0;
+}
+
+void stat_add(int stage, long long start) {
+    struct stage_stat *stat = &stats[stats_slot].stages[stage];
+
+    // Single writer: a relaxed load and store is enough and avoids a locked add
+    atomic_store_explicit(&stat->count, atomic_load_explicit(&stat->count, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&stat->ns, atomic_load_explicit(&stat->ns, memory_order_relaxed) + (now_ns() - start),
+                          memory_order_relaxed);
+}
+
+void handle_stats_signal(int signum) {
+    (void)signum;
+    stats_requested = 1;
+}
+
+void dump_stats(void) {
+    stats_requested = 0;
+
+    // Snapshot of the shared counters, taken while the children keep running
+    for (int i = 0; i <= num_workers; i++) {
+        if (i == num_workers) {
+            fprintf(stderr, "parent:");
+        } else {
+            fprintf(stderr, "child %d (%s): %llu requests,", i, operations[worker_op[i]].name,
+                    atomic_load_explicit(&stats[i].requests, memory_order_relaxed));
+        }
+        unsigned long long hits = atomic_load_explicit(&stats[i].spin_hits, memory_order_relaxed);
+        unsigned long long misses = atomic_load_explicit(&stats[i].spin_misses, memory_order_relaxed);
+        if (hits + misses > 0) {
+            fprintf(stderr, " spin %llu hit / %llu blocked,", hits, misses);
+        }
+        for (int stage = 0; stage < NUM_STAGES; stage++) {
+            unsigned long long count = atomic_load_explicit(&stats[i].stages[stage].count, memory_order_relaxed);
+            unsigned long long ns = atomic_load_explicit(&stats[i].stages[stage].ns, memory_order_relaxed);
+            if (count > 0) {
+                fprintf(stderr, " %s %llu x %llu ns", stage_names[stage], count, ns / count);
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+    if (offload_policy == OFFLOAD_AUTO) {
+        fprintf(stderr, "offload: %.0f ns + %.2f ns/pair per frame, inline", offload_frame_ns, offload_pair_ns);
+        for (int op = 0; op < NUM_OPS; op++) {
+            fprintf(stderr, " %s %.2f", operations[op].name, inline_pair_ns[op]);
+        }
+        fprintf(stderr, " ns/pair, %llu frames inlined, %llu offloaded\n", inlined_frames, offloaded_frames);
+    }
+    if (full_frames + partial_frames > 0) {
+        fprintf(stderr, "frames: %llu full, %llu partial, %.1f pairs per frame, %llu waits for a worker\n",
+                full_frames, partial_frames, (double)framed_pairs / (full_frames + partial_frames), window_waits);
+    }
+    if (cache) {
+        fprintf(stderr, "cache: %u entries, %llu hits, %llu misses, %llu evictions\n", cache_mask + 1, cache_hits,
+                cache_misses, cache_evictions);
+    }
+}
+
+int uring_setup(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    uring.fd = syscall(SYS_io_uring_setup, URING_ENTRIES, &params);
+    if (uring.fd == -1) {
+        return 0;
+    }
+    uring.entries = params.sq_entries;
+
+    // Submission and completion rings share one mapping on current kernels
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+    }
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+    char *cq = sq;
+    if (sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+    }
+    uring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+    uring_frames = malloc(FRAME_SLOTS * sizeof(uring_frames[0]));
+    if (sq == MAP_FAILED || cq == MAP_FAILED || uring.sqes == MAP_FAILED || !uring_frames) {
+        close(uring.fd);
+        return 0;
+    }
+
+    uring.sq_head = (atomic_uint *)(sq + params.sq_off.head);
+    uring.sq_tail = (atomic_uint *)(sq + params.sq_off.tail);
+    uring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    uring.sq_array = (unsigned *)(sq + params.sq_off.array);
+    uring.cq_head = (atomic_uint *)(cq + params.cq_off.head);
+    uring.cq_tail = (atomic_uint *)(cq + params.cq_off.tail);
+    uring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 1;
+}
+
+struct io_uring_sqe *uring_sqe(uint32_t kind, uint32_t index) {
+    unsigned tail = atomic_load_explicit(uring.sq_tail, memory_order_relaxed);
+
+    // Submit what is queued when the ring is full
+    while (tail - atomic_load_explicit(uring.sq_head, memory_order_acquire) == uring.entries) {
+        uring_enter(0);
+    }
+
+    unsigned slot = tail & *uring.sq_mask;
+    struct io_uring_sqe *sqe = &uring.sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uint64_t)kind << 32 | index;
+    uring.sq_array[slot] = slot;
+    atomic_store_explicit(uring.sq_tail, tail + 1, memory_order_release);
+    uring.to_submit++;
+    return sqe;
+}
+
+void uring_enter(unsigned min_complete) {
+    if (uring.to_submit == 0 && min_complete == 0) {
+        return;
+    }
+    while (1) {
+        long n = syscall(SYS_io_uring_enter, uring.fd, uring.to_submit, min_complete,
+                         min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n >= 0) {
+            uring.to_submit -= n;
+            return;
+        }
+        if (errno != EINTR) {
+            perror("Parent: Error entering io_uring");
+            exit(EXIT_FAILURE);
+        }
+        if (stats_requested) {
+            dump_stats();
+        }
+    }
+}
+
+int uring_reap(void) {
+    unsigned head = atomic_load_explicit(uring.cq_head, memory_order_relaxed);
+    int reaped = 0;
+
+    while (head != atomic_load_explicit(uring.cq_tail, memory_order_acquire)) {
+        uring_completion(&uring.cqes[head & *uring.cq_mask]);
+        head++;
+        reaped++;
+        atomic_store_explicit(uring.cq_head, head, memory_order_release);
+    }
+    return reaped;
+}
+
+void uring_start(void) {
+    if (uring_active) {
+        return;
+    }
+    uring_active = 1;
+
+    // A read stays posted on every result pipe from now on
+    for (int i = 0; i < num_workers; i++) {
+        uring_read_results(i);
+    }
+}
+
+void uring_write_frame(int index) {
+    struct uring_child *child = &uring_children[index];
+    int *wire = uring_frames[child->queue[0] % FRAME_SLOTS];
+    size_t len = (2 + 2 * frame_pairs(wire[1])) * sizeof(int);
+
+    // The write and the child's wakeup go out together; the link holds the
+    // wakeup back until the whole frame is in the pipe, and a short write
+    // cancels it so the rest is sent with a fresh one
+    struct io_uring_sqe *sqe = uring_sqe(URING_FRAME_WRITE, index);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = pipes_to_child[index][1];
+    sqe->addr = (uintptr_t)wire + child->written;
+    sqe->len = len - child->written;
+    sqe->off = -1;
+    sqe->flags = IOSQE_IO_LINK;
+
+    sqe = uring_sqe(URING_WAKE, index);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = event_fds[index];
+    sqe->addr = (uintptr_t)&wake_value;
+    sqe->len = sizeof(wake_value);
+    sqe->off = -1;
+    child->writing = 1;
+}
+
+void uring_read_results(int index) {
+    struct uring_child *child = &uring_children[index];
+    struct io_uring_sqe *sqe = uring_sqe(URING_RESULT_READ, index);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = pipes_to_parent[index][0];
+    sqe->addr = (uintptr_t)child->rx + child->rx_used;
+    sqe->len = sizeof(child->rx) - child->rx_used;
+    sqe->off = -1;
+}
+
+void uring_completion(struct io_uring_cqe *cqe) {
+    static struct result_frame done;
+    int kind = cqe->user_data >> 32;
+    int index = (uint32_t)cqe->user_data;
+    struct uring_child *child = &uring_children[index];
+
+    if (kind == URING_WAKE) {
+        if (cqe->res < 0 && cqe->res != -ECANCELED) {
+            errno = -cqe->res;
+            perror("Parent: Error writing eventfd");
+            exit(EXIT_FAILURE);
+        }
+    } else if (kind == URING_FRAME_WRITE) {
+        if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+            errno = -cqe->res;
+            perror("Parent: Error writing numbers to child");
+            exit(EXIT_FAILURE);
+        }
+        int *wire = uring_frames[child->queue[0] % FRAME_SLOTS];
+        child->written += cqe->res > 0 ? cqe->res : 0;
+        if (child->written == (2 + 2 * frame_pairs(wire[1])) * sizeof(int)) {
+            // Done, start on the next queued frame
+            child->written = 0;
+            child->queued--;
+            memmove(child->queue, child->queue + 1, child->queued * sizeof(child->queue[0]));
+        } else if (cqe->res > 0) {
+            // The short write cancelled the linked wakeup; wake the child
+            // anyway so it reads what is there and the pipe can take the rest
+            struct io_uring_sqe *sqe = uring_sqe(URING_WAKE, index);
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = event_fds[index];
+            sqe->addr = (uintptr_t)&wake_value;
+            sqe->len = sizeof(wake_value);
+            sqe->off = -1;
+        }
+        child->writing = 0;
+        if (child->queued > 0) {
+            uring_write_frame(index);
+        }
+    } else if (kind == URING_RESULT_READ) {
+        if (cqe->res <= 0) {
+            errno = cqe->res < 0 ? -cqe->res : EPIPE;
+            perror("Parent: Error reading result from child");
+            exit(EXIT_FAILURE);
+        }
+        long long start = now_ns();
+        long long cpu = parent_cpu_ns();
+        child->rx_used += cqe->res;
+
+        // Complete every whole frame in the buffer, keep a partial one for the next read
+        size_t offset = 0;
+        while (child->rx_used - offset >= 3 * sizeof(int)) {
+            int *words = (int *)((char *)child->rx + offset);
+            if (words[2] < 1 || words[2] > BATCH_MAX) {
+                fprintf(stderr, "Parent: Corrupt result frame from child %d\n", index);
+                exit(EXIT_FAILURE);
+            }
+            size_t len = (3 + words[2]) * sizeof(int);
+            if (child->rx_used - offset < len) {
+                break;
+            }
+            memcpy(&done.seq, words, 3 * sizeof(int));
+            memcpy(done.results, words + 3, words[2] * sizeof(int));
+            offset += len;
+            stat_add(STAGE_RECEIVE, start);
+            inflight[done.seq % FRAME_SLOTS].cost += cpu_since(cpu);
+            complete_frame(&done);
+        }
+        child->rx_used -= offset;
+        memmove(child->rx, (char *)child->rx + offset, child->rx_used);
+        uring_read_results(index);
+    } else if (kind == URING_OUTPUT) {
+        if (cqe->res < 0 && cqe->res != -EINTR && cqe->res != -EAGAIN) {
+            errno = -cqe->res;
+            perror("Parent: Error writing output");
+            exit(EXIT_FAILURE);
+        }
+        output_pending = cqe->res > 0 ? cqe->res : 0;
+    }
+}
+
+int read_full(int fd, void *buf, size_t len) {
+    char *p = buf;
+
+    // Pipes may return less than requested for frames larger than PIPE_BUF
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0) {
+            errno = EPIPE;  // The other end is gone
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int write_full(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int readv_full(int fd, struct iovec *parts, int count) {
+    // read_full for a frame scattered over several buffers; parts is used up on the way
+    while (count > 0) {
+        ssize_t n = readv(fd, parts, count);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0) {
+            errno = EPIPE;  // The other end is gone
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        for (; count > 0 && (size_t)n >= parts->iov_len; parts++, count--) {
+            n -= parts->iov_len;
+        }
+        if (count > 0) {
+            parts->iov_base = (char *)parts->iov_base + n;
+            parts->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int writev_full(int fd, struct iovec *parts, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, parts, count);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return -1;
+        }
+        for (; count > 0 && (size_t)n >= parts->iov_len; parts++, count--) {
+            n -= parts->iov_len;
+        }
+        if (count > 0) {
+            parts->iov_base = (char *)parts->iov_base + n;
+            parts->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+void ring_push(struct shm_ring *ring, const int *words, unsigned count) {
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    int spins = 0;
+
+    for (unsigned done = 0; done < count;) {
+        // Copy as much as fits, then publish it with a single store
+        unsigned space = RING_WORDS - (tail - atomic_load_explicit(&ring->head, memory_order_acquire));
+        if (space == 0) {
+            spin_wait(&spins);
+            continue;
+        }
+        unsigned n = count - done < space ? count - done : space;
+        for (unsigned i = 0; i < n; i++) {
+            ring->words[(tail + i) & (RING_WORDS - 1)] = words[done + i];
+        }
+        tail += n;
+        done += n;
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+}
+
+void ring_pop(struct shm_ring *ring, int *words, unsigned count) {
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    int spins = 0;
+
+    for (unsigned done = 0; done < count;) {
+        unsigned avail = atomic_load_explicit(&ring->tail, memory_order_acquire) - head;
+        if (avail == 0) {
+            spin_wait(&spins);
+            continue;
+        }
+        unsigned n = count - done < avail ? count - done : avail;
+        for (unsigned i = 0; i < n; i++) {
+            words[done + i] = ring->words[(head + i) & (RING_WORDS - 1)];
+        }
+        head += n;
+        done += n;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+}
+
+void spin_wait(int *spins) {
+    // Busy-wait briefly, then let the other side have the CPU
+    if (++*spins < SPIN_LIMIT) {
+        cpu_pause();
+    } else {
+        sched_yield();
+        *spins = 0;
+    }
+}
+
+void cpu_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+int spin_for_change(atomic_uint *word, unsigned seen) {
+    // Poll a shared word until it moves or the spin budget runs out, pausing
+    // a little longer each round so a long spin steals less from a hyperthread
+    struct process_stats *own = &stats[stats_slot];
+    long long deadline = now_ns() + spin_ns;
+    int pauses = 1;
+
+    while (atomic_load_explicit(word, memory_order_acquire) == seen) {
+        if (now_ns() >= deadline) {
+            atomic_store_explicit(&own->spin_misses, atomic_load_explicit(&own->spin_misses, memory_order_relaxed) + 1,
+                                  memory_order_relaxed);
+            return 0;
+        }
+        for (int i = 0; i < pauses; i++) {
+            cpu_pause();
+        }
+        pauses = pauses < 64 ? 2 * pauses : 64;
+    }
+    atomic_store_explicit(&own->spin_hits, atomic_load_explicit(&own->spin_hits, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    return 1;
+}
@@ -6,115 +6,135 @@
 #include <sys/wait.h>
 
 #define SIZE 50
+#define NUM_WORKERS 3
 
-int pfd_to_child[2]; // Pipe to send data to child
-int pfd_to_parent[2]; // Pipe to receive data from child
+int pfd_to_child[NUM_WORKERS][2];  // Private pipe to send data to each child
+int pfd_to_parent[NUM_WORKERS][2]; // Private pipe to receive data from each child
+int child_index;                   // Worker this child process serves
 
 void signal_handler(int signum);
 
 int main() {
-    pid_t pid_add, pid_sub, pid_mul;
+    pid_t pids[NUM_WORKERS];
+    int signals[NUM_WORKERS] = {SIGUSR1, SIGUSR2, SIGALRM};  // Addition, subtraction, multiplication
 
-    // Create pipes
-    if (pipe(pfd_to_child) == -1) {
-        perror("Error creating pipe to child");
-        exit(EXIT_FAILURE);
+    // Create one pair of pipes per worker, so no child can read another's operands
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        if (pipe(pfd_to_child[i]) == -1) {
+            perror("Error creating pipe to child");
+            exit(EXIT_FAILURE);
+        }
+        if (pipe(pfd_to_parent[i]) == -1) {
+            perror("Error creating pipe to parent");
+            exit(EXIT_FAILURE);
+        }
     }
-    if (pipe(pfd_to_parent) == -1) {
-        perror("Error creating pipe to parent");
-        exit(EXIT_FAILURE);
+
+    // Block the worker signals before forking: a signal sent before a child
+    // reaches sigwait() stays pending instead of killing it
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        sigaddset(&mask, signals[i]);
     }
+    sigprocmask(SIG_BLOCK, &mask, NULL);
 
-    // Fork addition process
-    pid_add = fork();
-    if (pid_add == -1) {
-        perror("Error forking addition process");
-        exit(EXIT_FAILURE);
-    } else if (pid_add == 0) {  // Addition child process
-        signal(SIGUSR1, signal_handler);
-        close(pfd_to_child[1]);  // Close write end of pipe to child
-        close(pfd_to_parent[0]); // Close read end of pipe to parent
-        pause();                 // Wait for signal
-        exit(0);
-    } else {
-        // Fork subtraction process
-        pid_sub = fork();
-        if (pid_sub == -1) {
-            perror("Error forking subtraction process");
+    // Fork the workers once; they serve requests until the parent terminates them
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        pids[i] = fork();
+        if (pids[i] == -1) {
+            perror("Error forking worker process");
             exit(EXIT_FAILURE);
-        } else if (pid_sub == 0) {  // Subtraction child process
-            signal(SIGUSR2, signal_handler);
-            close(pfd_to_child[1]);  // Close write end of pipe to child
-            close(pfd_to_parent[0]); // Close read end of pipe to parent
-            pause();                 // Wait for signal
-            exit(0);
-        } else {
-            // Fork multiplication process
-            pid_mul = fork();
-            if (pid_mul == -1) {
-                perror("Error forking multiplication process");
-                exit(EXIT_FAILURE);
-            } else if (pid_mul == 0) {  // Multiplication child process
-                signal(SIGALRM, signal_handler);
-                close(pfd_to_child[1]);  // Close write end of pipe to child
-                close(pfd_to_parent[0]); // Close read end of pipe to parent
-                pause();                 // Wait for signal
-                exit(0);
-            } else {
-                // Parent process
-                close(pfd_to_child[0]);  // Close read end of pipe to child
-                close(pfd_to_parent[1]); // Close write end of pipe to parent
-
-                char input[SIZE];
-                int num1, num2;
-                char op;
-
-                while (1) {
-                    printf("Enter two integers and an operation (+, -, *) or 'q' to quit: ");
-                    fgets(input, SIZE, stdin);
-
-                    if (input[0] == 'q') {
-                        break;
-                    }
-
-                    sscanf(input, "%d %d %c", &num1, &num2, &op);
-
-                    // Send data to child
-                    int nums[2] = {num1, num2};
-                    write(pfd_to_child[1], nums, sizeof(nums));
-
-                    // Signal appropriate child
-                    if (op == '+') {
-                        printf("The child process with PID: %d will provide the result.\n", pid_add);
-                        kill(pid_add, SIGUSR1);
-                    } else if (op == '-') {
-                        printf("The child process with PID: %d will provide the result.\n", pid_sub);
-                        kill(pid_sub, SIGUSR2);
-                    } else if (op == '*') {
-                        printf("The child process with PID: %d will provide the result.\n", pid_mul);
-                        kill(pid_mul, SIGALRM);
-                    } else {
-                        printf("Invalid operation.\n");
-                        continue;
-                    }
-
-                    // Read result from child
-                    int result;
-                    read(pfd_to_parent[0], &result, sizeof(result));
-                    printf("Result: %d\n\n", result);
+        } else if (pids[i] == 0) {  // Worker child process
+            child_index = i;
+            for (int j = 0; j < NUM_WORKERS; j++) {
+                close(pfd_to_child[j][1]);  // Close write ends of pipes to children
+                close(pfd_to_parent[j][0]); // Close read ends of pipes to parent
+                if (j != i) {
+                    close(pfd_to_child[j][0]);  // Keep only this worker's channel
+                    close(pfd_to_parent[j][1]);
                 }
+            }
 
-                // Close pipes
-                close(pfd_to_child[1]);
-                close(pfd_to_parent[0]);
-
-                // Wait for child processes to finish
-                wait(NULL);
-                wait(NULL);
-                wait(NULL);
+            sigset_t own;
+            sigemptyset(&own);
+            sigaddset(&own, signals[i]);
+            while (1) {
+                int signum;
+                if (sigwait(&own, &signum) == 0) {  // Wait for the next request
+                    signal_handler(signum);
+                }
             }
         }
     }
+
+    // Parent process
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        close(pfd_to_child[i][0]);  // Close read end of pipe to child
+        close(pfd_to_parent[i][1]); // Close write end of pipe to parent
+    }
+
+    char input[SIZE];
+    int num1, num2;
+    char op;
+
+    while (1) {
+        printf("Enter two integers and an operation (+, -, *) or 'q' to quit: ");
+        if (!fgets(input, SIZE, stdin)) {
+            break;
+        }
+
+        if (input[0] == 'q') {
+            break;
+        }
+
+        if (sscanf(input, "%d %d %c", &num1, &num2, &op) != 3) {
+            printf("Invalid input.\n");
+            continue;
+        }
+
+        // Pick the worker before writing, so a bad operation leaves no stray operands behind
+        int index;
+        if (op == '+') {
+            index = 0;
+        } else if (op == '-') {
+            index = 1;
+        } else if (op == '*') {
+            index = 2;
+        } else {
+            printf("Invalid operation.\n");
+            continue;
+        }
+
+        // Send data to the worker's own pipe and signal it
+        int nums[2] = {num1, num2};
+        printf("The child process with PID: %d will provide the result.\n", pids[index]);
+        if (write(pfd_to_child[index][1], nums, sizeof(nums)) != sizeof(nums)) {
+            perror("Error writing to child");
+            break;
+        }
+        kill(pids[index], signals[index]);
+
+        // Read result from the same worker
+        int result;
+        if (read(pfd_to_parent[index][0], &result, sizeof(result)) != sizeof(result)) {
+            perror("Error reading from child");
+            break;
+        }
+        printf("Result: %d\n\n", result);
+    }
+
+    // Close pipes and stop the workers
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        close(pfd_to_child[i][1]);
+        close(pfd_to_parent[i][0]);
+        kill(pids[i], SIGTERM);
+    }
+
+    // Wait for child processes to finish
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        wait(NULL);
+    }
     return 0;
 }
 
@@ -122,7 +142,10 @@ void signal_handler(int signum) {
     int nums[2];
 
     // Read data from parent
-    read(pfd_to_child[0], nums, sizeof(nums));
+    if (read(pfd_to_child[child_index][0], nums, sizeof(nums)) != sizeof(nums)) {
+        perror("Child: Error reading numbers");
+        exit(EXIT_FAILURE);
+    }
 
     int result;
     if (signum == SIGUSR1) {
@@ -140,7 +163,9 @@ void signal_handler(int signum) {
     }
 
     // Send result to parent
-    write(pfd_to_parent[1], &result, sizeof(result));
-
-    exit(0);  // Terminate child process after sending result
+    if (write(pfd_to_parent[child_index][1], &result, sizeof(result)) != sizeof(result)) {
+        perror("Child: Error writing result");
+        exit(EXIT_FAILURE);
+    }
+    // The worker stays alive for the next request
 }